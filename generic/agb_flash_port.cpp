@@ -8,6 +8,26 @@ extern "C" {
 #include <array>
 #include <string>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#undef max
+#undef min
 
 #ifndef NDEBUG
 #define CHECK_FLASH_OFFSET(_offset) \
@@ -31,22 +51,393 @@ namespace flash {
 // same as other flash implementations
 static constexpr size_t SectorSize = 4096;
 static constexpr size_t NumSectors = 32;
+static constexpr u32 AllSectors = 0xffffffffu;
+static_assert(NumSectors == 32, "dirty sectors are tracked in a u32");
+static_assert(SectorSize * NumSectors == FlashSize);
 
-static std::array<std::array<u8, SectorSize>, NumSectors> FlashMemory = {};
+using Sector = std::array<u8, SectorSize>;
+
+static std::array<Sector, NumSectors> HeapFlash = {};
+// points to HeapFlash, or to the save file itself when it is mapped into memory
+static Sector* FlashMemory = HeapFlash.data();
 static const std::string SavePath = "pokeruby.sav";
+static bool Persistent = true;
+static bool Mapped = false;
 
-static void DumpFlashMemory() {
-  std::ofstream file(SavePath, std::ios::trunc | std::ios::binary);
-  if (file.is_open()) {
-    file.write(reinterpret_cast<const char*>(&FlashMemory[0][0]), SectorSize * NumSectors);
-    file.close();
+#ifdef _WIN32
+static HANDLE MappedFile = INVALID_HANDLE_VALUE;
+static HANDLE MappedView = nullptr;
+#endif
+
+// map the save file as the flash array, it is created or extended as needed
+static bool MapSaveFile() {
+  const size_t size = SectorSize * NumSectors;
+  void* mapping = nullptr;
+
+#ifdef _WIN32
+  MappedFile = CreateFileA(SavePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (MappedFile == INVALID_HANDLE_VALUE) return false;
+
+  // the mapping extends the file if it is too small
+  MappedView = CreateFileMappingA(MappedFile, nullptr, PAGE_READWRITE, 0, (DWORD)size, nullptr);
+  if (MappedView) {
+    mapping = MapViewOfFile(MappedView, FILE_MAP_ALL_ACCESS, 0, 0, size);
   }
-  else {
-    log_fatal("Failed to open save file!");
+  if (!mapping) {
+    if (MappedView) CloseHandle(MappedView);
+    CloseHandle(MappedFile);
+    MappedView = nullptr;
+    MappedFile = INVALID_HANDLE_VALUE;
+    return false;
+  }
+#else
+  const int fd = open(SavePath.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) || ((size_t)info.st_size < size && ftruncate(fd, size))) {
+    close(fd);
+    return false;
+  }
+  mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // the mapping keeps the file open
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+#endif
+
+  FlashMemory = static_cast<Sector*>(mapping);
+  Mapped = true;
+  return true;
+}
+
+// copy the mapped save to HeapFlash and drop the mapping, without writing anything back
+static void UnmapSaveFile() {
+  if (!Mapped) return;
+
+  std::memcpy(HeapFlash.data(), FlashMemory, sizeof(HeapFlash));
+#ifdef _WIN32
+  UnmapViewOfFile(FlashMemory);
+  CloseHandle(MappedView);
+  CloseHandle(MappedFile);
+  MappedView = nullptr;
+  MappedFile = INVALID_HANDLE_VALUE;
+#else
+  munmap(FlashMemory, sizeof(HeapFlash));
+#endif
+  FlashMemory = HeapFlash.data();
+  Mapped = false;
+}
+
+// write the given sectors of the mapped save back to disk
+static bool SyncMappedSectors(u32 sectors) {
+  u8* const base = FlashMemory[0].data();
+  bool success = true;
+
+#ifndef _WIN32
+  // msync needs page aligned ranges, pages may be larger than sectors
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+
+  for (size_t i = 0; i < NumSectors;) {
+    if (!(sectors & (1u << i))) {
+      i++;
+      continue;
+    }
+
+    // sync runs of dirty sectors at once
+    size_t end = i + 1;
+    while (end < NumSectors && (sectors & (1u << end))) end++;
+
+#ifdef _WIN32
+    success &= FlushViewOfFile(base + i * SectorSize, (end - i) * SectorSize) != 0;
+#else
+    const size_t start = (i * SectorSize) & ~(page_size - 1);
+    success &= msync(base + start, end * SectorSize - start, MS_SYNC) == 0;
+#endif
+    i = end;
+  }
+
+#ifdef _WIN32
+  // FlushViewOfFile does not wait for the data to hit the disk
+  success &= FlushFileBuffers(MappedFile) != 0;
+#endif
+  if (!success) {
+    log_warn("Failed to sync %s", SavePath.c_str());
+  }
+  return success;
+}
+
+// the game saves by programming flash byte by byte, thousands of times per save,
+// so instead of rewriting the save file on every write, a writer thread collects
+// the sectors that changed and commits them once the game has stopped writing for a bit
+//
+// FlashMemory is only written by the game thread, while holding the writer's mutex,
+// the writer thread only reads it while holding the mutex
+//
+// when the save file is mapped, writes already end up in the file,
+// and commits only sync the dirty sectors
+struct SaveWriter {
+  using Clock = std::chrono::steady_clock;
+
+  // wait this long after the last write, but at most MaxDelay after the first unwritten one
+  static constexpr auto Delay    = std::chrono::milliseconds(250);
+  static constexpr auto MaxDelay = std::chrono::milliseconds(2000);
+  // after a failed commit
+  static constexpr auto RetryDelay = std::chrono::milliseconds(5000);
+
+  SaveWriter();
+  ~SaveWriter();
+
+  // modify FlashMemory in write, which touches the given sectors
+  template<typename F>
+  void Write(u32 sectors, F&& write);
+
+  // commit any pending writes, returns once they are on disk
+  void Flush();
+
+  // replace FlashMemory without committing it, for save states
+  // the game's next writes to a sector commit it along with them
+  void Restore(const u8* src);
+
+private:
+  void Run();
+  void Commit(std::unique_lock<std::mutex>& lock);
+
+  std::mutex mutex{};
+  std::condition_variable wake{};
+  std::condition_variable committed{};
+
+  u32 dirty = 0;
+  bool writing = false;
+  bool stop = false;
+  Clock::time_point first_write{};
+  Clock::time_point last_write{};
+  Clock::time_point retry{};
+
+  // the writer thread's copy of the save, only dirty sectors are copied into it
+  // unused when the save file is mapped
+  std::array<Sector, NumSectors> image{};
+  std::thread thread{};
+};
+
+SaveWriter::SaveWriter() {
+  if (!Mapped) {
+    std::memcpy(image.data(), FlashMemory, sizeof(image));
+  }
+  thread = std::thread(&SaveWriter::Run, this);
+}
+
+SaveWriter::~SaveWriter() {
+  {
+    std::lock_guard lock(mutex);
+    stop = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+template<typename F>
+void SaveWriter::Write(u32 sectors, F&& write) {
+  {
+    std::lock_guard lock(mutex);
+    write();
+
+    const auto now = Clock::now();
+    if (!dirty) first_write = now;
+    last_write = now;
+    dirty |= sectors;
+  }
+  wake.notify_one();
+}
+
+void SaveWriter::Flush() {
+  // commit on the calling thread, so we don't have to wait out the delay
+  std::unique_lock lock(mutex);
+  Commit(lock);
+}
+
+void SaveWriter::Restore(const u8* src) {
+  std::unique_lock lock(mutex);
+  // what the game wrote before goes to disk first, or its sectors would be committed with the restored data
+  Commit(lock);
+  if (Mapped) {
+    // writes to a mapped save go straight to the file, so from now on the save is a copy in memory
+    UnmapSaveFile();
+    std::memcpy(image.data(), FlashMemory, sizeof(image));
+    log_info("Loaded a save state, %s is no longer mapped", SavePath.c_str());
+  }
+  std::memcpy(FlashMemory, src, FlashSize);
+}
+
+static bool SyncFile(FILE* file) {
+  if (std::fflush(file)) return false;
+#ifdef _WIN32
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// write the save to a temporary file next to it and rename it over the old one,
+// so a crash or full disk never leaves a half written save behind
+static bool WriteSaveFile(const void* data, size_t size) {
+  const std::string temp_path = SavePath + ".tmp";
+
+  FILE* file = std::fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    log_warn("Failed to open %s for writing", temp_path.c_str());
+    return false;
+  }
+  const bool written = std::fwrite(data, 1, size, file) == size && SyncFile(file);
+  std::fclose(file);
+  if (!written) {
+    log_warn("Failed to write %s", temp_path.c_str());
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+#ifdef _WIN32
+  if (!MoveFileExA(temp_path.c_str(), SavePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    log_warn("Failed to replace %s", SavePath.c_str());
+    return false;
+  }
+#else
+  if (std::rename(temp_path.c_str(), SavePath.c_str())) {
+    log_warn("Failed to replace %s", SavePath.c_str());
+    return false;
+  }
+
+  // make the rename itself durable
+  std::string directory = std::filesystem::path(SavePath).parent_path().string();
+  if (directory.empty()) directory = ".";
+  const int fd = open(directory.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+#endif
+  return true;
+}
+
+void SaveWriter::Commit(std::unique_lock<std::mutex>& lock) {
+  // Flush and the writer thread might both want to commit
+  committed.wait(lock, [&]{ return !writing; });
+  if (!dirty) return;
+
+  const u32 sectors = dirty;
+  if (!Mapped) {
+    for (size_t i = 0; i < NumSectors; i++) {
+      if (sectors & (1u << i)) {
+        image[i] = FlashMemory[i];
+      }
+    }
+  }
+  dirty   = 0;
+  writing = true;
+
+  // the game can keep writing while we are on disk
+  lock.unlock();
+  const bool success = Mapped ? SyncMappedSectors(sectors) : WriteSaveFile(image.data(), sizeof(image));
+  lock.lock();
+
+  writing = false;
+  if (!success) {
+    // the image is still up to date, but it has to be written again
+    const auto now = Clock::now();
+    if (!dirty) first_write = last_write = now;
+    dirty |= sectors;
+    retry = now + RetryDelay;
+  }
+  committed.notify_all();
+}
+
+void SaveWriter::Run() {
+  std::unique_lock lock(mutex);
+  while (true) {
+    wake.wait(lock, [&]{ return stop || dirty; });
+    if (stop) break;
+
+    // coalesce writes until the game is done saving
+    while (!stop && dirty) {
+      const auto deadline = std::max(retry, std::min(last_write + Delay, first_write + MaxDelay));
+      if (Clock::now() >= deadline) break;
+      wake.wait_until(lock, deadline);
+    }
+    if (stop) break;
+
+    Commit(lock);
+  }
+
+  // whatever is left is written on the way out
+  Commit(lock);
+}
+
+static SaveWriter& GetSaveWriter() {
+  // constructed on the first write, after the save has been loaded
+  static SaveWriter writer{};
+  return writer;
+}
+
+// all writes to FlashMemory go through here
+template<typename F>
+static void WriteFlash(u32 sectors, F&& write) {
+  if (!Persistent) {
+    write();
+    return;
+  }
+  GetSaveWriter().Write(sectors, std::forward<F>(write));
+}
+
+void SetPersistent(bool persistent) {
+  Persistent = persistent;
+  if (!Persistent) {
+    // writes to a mapped save go straight to the file
+    UnmapSaveFile();
+  }
+}
+
+u64 Checksum() {
+  u64 hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < NumSectors; i++) {
+    for (u8 byte : FlashMemory[i]) {
+      hash = (hash ^ byte) * 0x100000001b3ull;
+    }
   }
+  return hash;
+}
+
+void CopyFlashMemory(u8* dest) {
+  std::memcpy(dest, FlashMemory, FlashSize);
 }
 
-void LoadFlashMemory() {
+void RestoreFlashMemory(const u8* src) {
+  u32 sectors = 0;
+  for (size_t i = 0; i < NumSectors; i++) {
+    if (std::memcmp(FlashMemory[i].data(), src + i * SectorSize, SectorSize)) {
+      sectors |= 1u << i;
+    }
+  }
+  if (!sectors) return;
+
+  if (!Persistent) {
+    std::memcpy(FlashMemory, src, FlashSize);
+    return;
+  }
+  GetSaveWriter().Restore(src);
+}
+
+void DumpFlashMemory() {
+  if (!Persistent) return;
+
+  GetSaveWriter().Flush();
+}
+
+void LoadFlashMemory(bool mapped) {
+  if (mapped) {
+    if (MapSaveFile()) return;
+    log_warn("Failed to map %s, falling back to reading it", SavePath.c_str());
+  }
+
   std::ifstream file(SavePath, std::ios::binary);
 
   if (file.is_open()) {
@@ -62,28 +453,24 @@ void LoadFlashMemory() {
 u16 ProgramFlashByte(u16 sectorNum, u32 offset, u8 data) {
   CHECK_FLASH_SECTOR(sectorNum)
   CHECK_FLASH_OFFSET(offset)
-  FlashMemory[sectorNum][offset] = data;
-  DumpFlashMemory();
+  WriteFlash(1u << sectorNum, [&]{ FlashMemory[sectorNum][offset] = data; });
   return 0;  // always successful
 }
 
 u16 ProgramFlashSector(u16 sectorNum, void *src) {
   CHECK_FLASH_SECTOR(sectorNum)
-  std::memcpy(FlashMemory[sectorNum].data(), src, SectorSize);
-  DumpFlashMemory();
+  WriteFlash(1u << sectorNum, [&]{ std::memcpy(FlashMemory[sectorNum].data(), src, SectorSize); });
   return 0;  // always successful
 }
 
 u16 EraseFlashChip() {
-  FlashMemory = {};
-  DumpFlashMemory();
+  WriteFlash(AllSectors, [&]{ std::fill_n(FlashMemory, NumSectors, Sector{}); });
   return 0;  // always successful
 }
 
 u16 EraseFlashSector(u16 sectorNum) {
   CHECK_FLASH_SECTOR(sectorNum)
-  FlashMemory[sectorNum] = {};
-  DumpFlashMemory();
+  WriteFlash(1u << sectorNum, [&]{ FlashMemory[sectorNum] = {}; });
   return 0;  // always successful
 }
 
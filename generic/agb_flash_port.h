@@ -1,6 +1,22 @@
 #pragma once
 
+#include "helpers.h"
+
 namespace flash {
-void LoadFlashMemory();
+// with mapped set, the save file itself is used as flash memory, so saving only syncs the sectors that changed
+// this falls back to reading the save file if it can't be mapped
+void LoadFlashMemory(bool mapped = false);
 void DumpFlashMemory();
+
+// keep flash writes in memory only, so that runs do not change the save file
+void SetPersistent(bool persistent);
+
+// FNV-1a hash of the flash contents
+u64 Checksum();
+
+// for save states
+static constexpr size_t FlashSize = 0x20000;
+void CopyFlashMemory(u8* dest);
+// only in memory, the save file is left alone until the game writes flash again
+void RestoreFlashMemory(const u8* src);
 }
\ No newline at end of file
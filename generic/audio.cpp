@@ -0,0 +1,260 @@
+#include "audio.h"
+#include "log.h"
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SPIN_PAUSE() _mm_pause()
+#else
+#define SPIN_PAUSE()
+#endif
+
+#undef max
+#undef min
+
+extern "C" void SoundMainThreaded();
+extern "C" void SoundApplyRegisterWrites();
+
+namespace audio {
+
+// the ring holds frames at the rate they were mixed at, the consumer resamples them to the device rate,
+// and speeds up or slows down a little to keep the amount queued near the latency target,
+// the game is paced by its own clock, which never quite matches the sound card's
+//
+// positions count frames from Open and wrap around on their own, the ring size is a power of 2
+// the producer only writes WritePosition and the consumer only writes ReadPosition
+static constexpr u32 RingSize = 1 << 15;
+
+// how far the consumer strays from the source rate to catch up, 0.5% is not audible
+static constexpr double MaxRateAdjust = 0.005;
+
+static std::array<Frame, RingSize> Ring{};
+alignas(64) static std::atomic<u32> WritePosition{0};
+alignas(64) static std::atomic<u32> ReadPosition{0};
+
+static std::atomic<bool> Opened{false};
+static std::atomic<u32> SourceRate{0};
+static std::atomic<u32> LatencyMilliseconds{60};
+static u32 DeviceRate = 48000;
+static bool HighQuality = false;
+
+// threaded mode, the game thread sets SoundStateReleased, the audio thread sets EngineRunning while it uses the state
+// both check the other's flag after setting their own, so at most one of them goes ahead
+static bool Threaded = false;
+static std::atomic<bool> SoundStateReleased{false};
+static std::atomic<bool> EngineRunning{false};
+// set on the audio thread while it runs frames of the sound engine, for HelperHoldsSoundState
+static thread_local bool InSoundEngine = false;
+
+// consumer only
+static u64 Phase = 0;         // position between the frame at ReadPosition and the next one, 32.32 fixed point
+static bool Buffering = true; // waiting for the latency target to be queued up
+
+// written by one side each, read by LogReport
+static std::atomic<u64> Underruns{0};
+static std::atomic<u64> SilentFrames{0};
+static std::atomic<u64> Overruns{0};
+static std::atomic<u64> DroppedFrames{0};
+
+void SetLatency(u32 milliseconds) {
+  LatencyMilliseconds.store(std::clamp<u32>(milliseconds, 10, 250), std::memory_order_relaxed);
+}
+
+u32 GetLatency() {
+  return LatencyMilliseconds.load(std::memory_order_relaxed);
+}
+
+void SetHighQuality(bool high_quality) {
+  HighQuality = high_quality;
+}
+
+void SetThreaded(bool threaded) {
+  Threaded = threaded;
+}
+
+void ReleaseSoundState() {
+  SoundStateReleased.store(true, std::memory_order_seq_cst);
+}
+
+void AcquireSoundState() {
+  SoundStateReleased.store(false, std::memory_order_seq_cst);
+  // the audio thread checks the flag before every frame, so this is one frame of sound at most
+  while (EngineRunning.load(std::memory_order_seq_cst)) {
+    SPIN_PAUSE();
+  }
+  // the register writes of the frames the audio thread ran
+  SoundApplyRegisterWrites();
+}
+
+u32 DeviceBufferFrames(u32 device_rate) {
+  // a quarter of the latency, the rest waits in the ring
+  const u32 quarter = (u32)((u64)GetLatency() * device_rate / 4000);
+  u32 frames = 256;
+  while (frames * 2 <= quarter && frames < 4096) frames *= 2;
+  return frames;
+}
+
+// frames to keep queued in the ring, at the source rate
+static u32 TargetFrames(u32 rate) {
+  const u64 device_buffer = (u64)DeviceBufferFrames(DeviceRate) * rate / DeviceRate;
+  const u64 latency       = (u64)GetLatency() * rate / 1000;
+  return (u32)std::clamp<u64>(latency - std::min(latency, device_buffer), device_buffer, RingSize / 4);
+}
+
+void Open(u32 device_rate) {
+  DeviceRate = device_rate;
+  WritePosition.store(0, std::memory_order_relaxed);
+  ReadPosition.store(0, std::memory_order_relaxed);
+  Phase     = 0;
+  Buffering = true;
+  Underruns     = 0;
+  SilentFrames  = 0;
+  Overruns      = 0;
+  DroppedFrames = 0;
+  Opened.store(true, std::memory_order_release);
+}
+
+void Close() {
+  Opened.store(false, std::memory_order_release);
+}
+
+void Push(const Frame* frames, u32 count, u32 sample_rate) {
+  if (!Opened.load(std::memory_order_acquire) || !sample_rate) return;
+
+  // the rate is published along with the frames
+  SourceRate.store(sample_rate, std::memory_order_relaxed);
+
+  const u32 write  = WritePosition.load(std::memory_order_relaxed);
+  const u32 queued = write - ReadPosition.load(std::memory_order_acquire);
+
+  // running faster than real time (turbo, or a slow sound card), twice the target is plenty
+  const u32 limit = 2 * TargetFrames(sample_rate) + count;
+  const u32 room  = limit > queued ? limit - queued : 0;
+  if (count > room) {
+    Overruns.fetch_add(1, std::memory_order_relaxed);
+    DroppedFrames.fetch_add(count - room, std::memory_order_relaxed);
+    count = room;
+  }
+
+  const u32 start = write & (RingSize - 1);
+  const u32 first = std::min(count, RingSize - start);
+  std::copy_n(frames, first, &Ring[start]);
+  std::copy_n(frames + first, count - first, Ring.data());
+  WritePosition.store(write + count, std::memory_order_release);
+}
+
+static s16 Lerp(s16 a, s16 b, u32 fraction) {
+  // a full scale difference times the fraction does not fit in 32 bits
+  return (s16)(a + (((s64)(b - a) * (fraction >> 16)) >> 16));
+}
+
+// audio thread, threaded mode: run frames of the sound engine until there is enough queued up for this callback
+static void RunSoundEngine(u32 count) {
+  EngineRunning.store(true, std::memory_order_seq_cst);
+  while (SoundStateReleased.load(std::memory_order_seq_cst)) {
+    const u32 write = WritePosition.load(std::memory_order_relaxed);
+    const u32 rate  = SourceRate.load(std::memory_order_relaxed);
+    if (rate) {
+      const u32 wanted = TargetFrames(rate) + (u32)((u64)count * rate / DeviceRate) + 2;
+      if (write - ReadPosition.load(std::memory_order_relaxed) >= wanted) break;
+    }
+
+    InSoundEngine = true;
+    SoundMainThreaded();
+    InSoundEngine = false;
+    // the game has not set up sound yet
+    if (WritePosition.load(std::memory_order_relaxed) == write) break;
+  }
+  EngineRunning.store(false, std::memory_order_seq_cst);
+}
+
+void Drain(Frame* out, u32 count) {
+  if (Threaded) RunSoundEngine(count);
+
+  u32 read        = ReadPosition.load(std::memory_order_relaxed);
+  const u32 write = WritePosition.load(std::memory_order_acquire);
+  const u32 rate  = SourceRate.load(std::memory_order_relaxed);
+  u32 available   = write - read;
+
+  u32 done = 0;
+  const u32 target = rate ? TargetFrames(rate) : 0;
+  if (Buffering && rate && available >= target) {
+    Buffering = false;
+  }
+
+  if (!Buffering) {
+    // proportional to how far off the target we are, the adjustment is too small to hear
+    const double error = std::clamp(((double)available - target) / target, -1.0, 1.0);
+    const double ratio = (double)rate / DeviceRate * (1.0 + MaxRateAdjust * error);
+    const u64 step     = (u64)(ratio * 4294967296.0);
+
+    for (; done < count; done++) {
+      // interpolating needs the frame after the current one
+      if (available < 2) {
+        Underruns.fetch_add(1, std::memory_order_relaxed);
+        SilentFrames.fetch_add(count - done, std::memory_order_relaxed);
+        Buffering = true;
+        break;
+      }
+
+      const Frame& a = Ring[read & (RingSize - 1)];
+      const Frame& b = Ring[(read + 1) & (RingSize - 1)];
+      const u32 fraction = (u32)Phase;
+      out[done] = {Lerp(a.left, b.left, fraction), Lerp(a.right, b.right, fraction)};
+
+      Phase += step;
+      const u32 advance = (u32)std::min<u64>(Phase >> 32, available - 1);
+      Phase     &= 0xffffffff;
+      read      += advance;
+      available -= advance;
+    }
+    ReadPosition.store(read, std::memory_order_release);
+  }
+
+  std::fill(out + done, out + count, Frame{0, 0});
+}
+
+void LogReport() {
+  // nothing was ever played
+  if (!SourceRate.load(std::memory_order_relaxed)) return;
+
+  // printed in release builds too, where log_info is compiled out
+  std::printf(
+      "Sound: %llu underruns (%llu frames of silence), %llu overruns (%llu frames dropped)\n",
+      (unsigned long long)Underruns.load(std::memory_order_relaxed),
+      (unsigned long long)SilentFrames.load(std::memory_order_relaxed),
+      (unsigned long long)Overruns.load(std::memory_order_relaxed),
+      (unsigned long long)DroppedFrames.load(std::memory_order_relaxed)
+  );
+}
+
+}
+
+extern "C" {
+
+// the mixer output, interleaved 16 bit stereo
+void HelperPushSound(const s16* buffer, u32 samples, u32 sample_rate) {
+  static_assert(sizeof(audio::Frame) == 2 * sizeof(s16));
+  audio::Push(reinterpret_cast<const audio::Frame*>(buffer), samples, sample_rate);
+}
+
+bool32 HelperSoundThreaded() {
+  return audio::Threaded && audio::Opened.load(std::memory_order_acquire);
+}
+
+bool32 HelperHoldsSoundState() {
+  if (!HelperSoundThreaded() || audio::InSoundEngine) return TRUE;
+  return !audio::SoundStateReleased.load(std::memory_order_seq_cst);
+}
+
+u32 HelperHighQualitySoundRate() {
+  // there is no point without anyone listening
+  if (!audio::HighQuality || !audio::Opened.load(std::memory_order_acquire)) return 0;
+  return audio::DeviceRate;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "helpers.h"
+
+// sound output, the mixer pushes its output into a ring buffer on the game thread,
+// and the host drains it from its audio thread
+// there is exactly one of each, neither side ever waits on the other
+namespace audio {
+
+struct Frame {
+  s16 left;
+  s16 right;
+};
+
+// how much sound is kept queued up ahead of the host, in milliseconds
+// more survives longer stalls of the game thread, less keeps the sound closer to the picture
+void SetLatency(u32 milliseconds);
+u32 GetLatency();
+
+// mix straight at the device rate with a better interpolation, instead of at the game's rate, see SoundMain
+void SetHighQuality(bool high_quality);
+
+// threaded mode: the sequencer and the mixer run on the host's audio thread, whenever it needs more sound,
+// instead of in the game's VBlank interrupt, so sound keeps playing while the game thread is busy elsewhere
+// only while a device is open, and never with movies, music timing would then depend on the host
+// set before the host opens its device, the audio thread reads it without synchronization
+void SetThreaded(bool threaded);
+
+// the game's sound state (SoundInfo, the music players and their tracks) lives in game memory,
+// and the game's m4a calls write to it at any time while game code runs
+// in threaded mode, the frontend hands it to the audio thread while it works between frames,
+// and takes it back before the game runs again
+// the audio thread never waits for it, taking it back waits for at most one frame of sound
+// the audio thread leaves the PSG's register writes to the game thread, which makes them when taking the state back
+void ReleaseSoundState();
+void AcquireSoundState();
+
+// start and stop accepting sound for a host playing at this rate, sound pushed while closed is dropped
+// the consumer side of the ring has to be idle for both of these
+void Open(u32 device_rate);
+void Close();
+
+// game thread: queue sound at the rate it was mixed at
+// sound that does not fit is dropped and counted as an overrun
+void Push(const Frame* frames, u32 count, u32 sample_rate);
+
+// host audio thread: fill out with frames at the device rate
+// in threaded mode, this runs the sound engine first if the game thread has released the sound state
+// when the ring runs dry, the rest is silence and counted as an underrun,
+// and playback waits until the latency target is queued up again
+void Drain(Frame* out, u32 count);
+
+// device frames to use per host callback, for a latency target
+u32 DeviceBufferFrames(u32 device_rate);
+
+// underruns and overruns since the last Open
+void LogReport();
+
+}
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "dma.h"
+#include "helpers.libgba.h"
+#include "ppu/ppu.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#undef max
+#undef min
+
+DmaRegister DmaRegisters[dma::NumChannels] = {};
+extern const size_t DmaRegistersSize = sizeof(DmaRegisters);
+
+namespace dma {
+
+// a count of 0 transfers the maximum
+static constexpr u32 MaxCount[NumChannels] = {0x4000, 0x4000, 0x4000, 0x10000};
+
+static s32 AddressStep(u8 addr_ctrl, u32 unit) {
+  switch (addr_ctrl) {
+    case 0: return (s32)unit;   // increment
+    case 1: return -(s32)unit;  // decrement
+    case 2: return 0;           // fixed
+    case 3: return (s32)unit;   // increment, reload after the transfer (dest only)
+    default: log_fatal("Invalid address control: %d", addr_ctrl);
+  }
+}
+
+// transfer kernels, one is picked per transfer from the unit size and address steps
+// dest and src point at the first unit, steps are in units
+using Kernel = void (*)(u8* dest, const u8* src, u32 units);
+
+template<u32 Unit>
+static void Copy(u8* dest, const u8* src, u32 units) {
+  std::memmove(dest, src, (size_t)units * Unit);
+}
+
+// fixed source, the unit is repeated into a 64 bit pattern so the stores can be vectorized
+template<u32 Unit>
+static void Fill(u8* dest, const u8* src, u32 units) {
+  size_t size = (size_t)units * Unit;
+  if (Unit == sizeof(u16) ? src[0] == src[1] : src[0] == src[1] && src[0] == src[2] && src[0] == src[3]) {
+    // mostly clearing to 0
+    std::memset(dest, src[0], size);
+    return;
+  }
+
+  u64 pattern = 0;
+  for (u32 i = 0; i < sizeof(pattern); i += Unit) {
+    std::memcpy(reinterpret_cast<u8*>(&pattern) + i, src, Unit);
+  }
+
+  // dest is always aligned to the unit, get it aligned to the pattern
+  while (size && ((uintptr_t)dest & (sizeof(pattern) - 1))) {
+    std::memcpy(dest, src, Unit);
+    dest += Unit;
+    size -= Unit;
+  }
+  for (size_t i = 0; i < size / sizeof(pattern); i++) {
+    std::memcpy(dest + i * sizeof(pattern), &pattern, sizeof(pattern));
+  }
+  dest += size & ~(sizeof(pattern) - 1);
+  size &= sizeof(pattern) - 1;
+  for (; size; size -= Unit, dest += Unit) {
+    std::memcpy(dest, src, Unit);
+  }
+}
+
+// a fixed destination that is a plain register, only the last write sticks
+// the sound FIFOs queue every write instead, but transfers to them never run, see dma.h
+template<u32 Unit, s32 SrcStep>
+static void LastUnit(u8* dest, const u8* src, u32 units) {
+  std::memcpy(dest, src + (intptr_t)(units - 1) * SrcStep * (s32)Unit, Unit);
+}
+
+// anything else, including transfers that read back what they wrote
+template<u32 Unit, s32 SrcStep, s32 DstStep>
+static void Units(u8* dest, const u8* src, u32 units) {
+  for (u32 i = 0; i < units; i++) {
+    std::memcpy(dest + (intptr_t)i * DstStep * (s32)Unit, src + (intptr_t)i * SrcStep * (s32)Unit, Unit);
+  }
+}
+
+// steps are -1, 0 or 1
+template<u32 Unit, s32 SrcStep>
+static Kernel ChooseKernel(s32 dst_step, bool overlaps) {
+  switch (dst_step) {
+    case 0:
+      if (overlaps) return Units<Unit, SrcStep, 0>;
+      return LastUnit<Unit, SrcStep>;
+    case 1:
+      // writing the same unit over and over never changes it, even if it is overwritten itself
+      if constexpr (SrcStep == 0) return Fill<Unit>;
+      if (SrcStep == 1 && !overlaps) return Copy<Unit>;
+      return Units<Unit, SrcStep, 1>;
+    default:
+      return Units<Unit, SrcStep, -1>;
+  }
+}
+
+template<u32 Unit>
+static Kernel ChooseKernel(s32 src_step, s32 dst_step, bool overlaps) {
+  switch (src_step) {
+    case 0:  return ChooseKernel<Unit, 0>(dst_step, overlaps);
+    case 1:  return ChooseKernel<Unit, 1>(dst_step, overlaps);
+    default: return ChooseKernel<Unit, -1>(dst_step, overlaps);
+  }
+}
+
+static void Transfer(DmaRegister& dma, u32 unit, u32 units, s32 src_step, s32 dst_step) {
+  u8* dest      = static_cast<u8*>(dma.dest);
+  const u8* src = static_cast<const u8*>(dma.src);
+
+  // spans from the first to the last unit, negative when the address is decremented
+  const intptr_t dst_span = (intptr_t)(units - 1) * dst_step;
+  const intptr_t src_span = (intptr_t)(units - 1) * src_step;
+  u8* const dst_first       = dest + std::min<intptr_t>(dst_span, 0);
+  const u8* const src_first = src + std::min<intptr_t>(src_span, 0);
+  ppu::MarkVramDirty(dst_first, std::abs(dst_span) + unit);
+
+  // when they overlap, units written may be read again later on
+  const bool overlaps = dst_first < src_first + std::abs(src_span) + unit
+                     && src_first < dst_first + std::abs(dst_span) + unit;
+  const Kernel kernel = unit == sizeof(u32)
+      ? ChooseKernel<sizeof(u32)>(src_step / (s32)unit, dst_step / (s32)unit, overlaps)
+      : ChooseKernel<sizeof(u16)>(src_step / (s32)unit, dst_step / (s32)unit, overlaps);
+  kernel(dest, src, units);
+
+  dma.src  = (void*)(src + (intptr_t)units * src_step);
+  dma.dest = (void*)(dest + (intptr_t)units * dst_step);
+}
+
+static void Finish(u32 channel) {
+  DmaRegister& dma = DmaRegisters[channel];
+  if (dma.dst_addr_ctrl == 3) {
+    dma.dest = dma.initial_dest;
+  }
+
+  // repeating channels stay enabled until they are stopped
+  if (!dma.repeat || dma.timing == static_cast<u32>(DmaRegister::Timing::Immediate)) {
+    dma.enable = 0;
+  }
+
+  if (dma.irq) {
+    nongeneric::HandleInterrupt(static_cast<Interrupt>(static_cast<u32>(Interrupt::Dma0) + channel));
+  }
+}
+
+static void Run(u32 channel) {
+  DmaRegister& dma = DmaRegisters[channel];
+  const u32 unit = dma.type ? sizeof(u32) : sizeof(u16);
+  Transfer(
+      dma,
+      unit,
+      dma.count ? dma.count : MaxCount[channel],
+      AddressStep(dma.src_addr_ctrl, unit),
+      AddressStep(dma.dst_addr_ctrl, unit)
+  );
+  Finish(channel);
+}
+
+static void RunPending(DmaRegister::Timing timing) {
+  // lower channels go first
+  for (u32 channel = 0; channel < NumChannels; channel++) {
+    if (DmaRegisters[channel].IsPending(timing)) {
+      Run(channel);
+    }
+  }
+}
+
+void OnVBlank() {
+  RunPending(DmaRegister::Timing::VBlank);
+}
+
+void OnHBlank() {
+  RunPending(DmaRegister::Timing::HBlank);
+}
+
+bool HasHBlankTransfers() {
+  for (const auto& dma : DmaRegisters) {
+    if (dma.IsPending(DmaRegister::Timing::HBlank)) return true;
+  }
+  return false;
+}
+
+bool HBlankTransfersWriteMemory() {
+  for (u32 channel = 0; channel < NumChannels; channel++) {
+    const DmaRegister& dma = DmaRegisters[channel];
+    if (!dma.IsPending(DmaRegister::Timing::HBlank)) continue;
+
+    const u32 unit   = dma.type ? sizeof(u32) : sizeof(u16);
+    const s32 step   = AddressStep(dma.dst_addr_ctrl, unit);
+    const intptr_t span = (intptr_t)((dma.count ? dma.count : MaxCount[channel]) - 1) * step;
+    const uintptr_t first = (uintptr_t)dma.dest + std::min<intptr_t>(span, 0);
+    const uintptr_t last  = (uintptr_t)dma.dest + std::max<intptr_t>(span, 0) + unit;
+    if (first < (uintptr_t)IORegisters || last > (uintptr_t)IORegisters + sizeof(IORegisters)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}
+
+extern "C" {
+
+void HelperDmaSet(u32 dmaNum, void* src, void* dest, u32 control) {
+  DmaRegister& dma = DmaRegisters[dmaNum];
+  dma.count         = control & 0xffff;
+  control >>= 16;
+  dma.dst_addr_ctrl = (control >> 5) & 3;
+  dma.src_addr_ctrl = (control >> 7) & 3;
+  dma.repeat        = (control >> 9) & 1;
+  dma.type          = (control >> 10) & 1;
+  dma.timing        = (control >> 12) & 3;
+  dma.irq           = (control >> 14) & 1;
+  dma.enable        = (control >> 15) & 1;
+  dma.dest          = dest;
+  dma.initial_dest  = dest;
+  dma.src           = src;
+
+  if (dma.IsPending(DmaRegister::Timing::Immediate)) {
+    dma::Run(dmaNum);
+  }
+  else if (dma.IsPending(DmaRegister::Timing::Special) && dmaNum == 3) {
+    // video capture, nothing uses this
+    log_warn("Unsupported video capture DMA");
+    dma.enable = 0;
+  }
+}
+//{                                                 \
+//    vu32 *dmaRegs = (vu32 *)REG_ADDR_DMA##dmaNum; \
+//    dmaRegs[0] = (vu32)(src);                     \
+//    dmaRegs[1] = (vu32)(dest);                    \
+//    dmaRegs[2] = (vu32)(control);                 \
+//    dmaRegs[2];                                   \
+//}
+
+void HelperDmaStop(u32 dmaNum) {
+  DmaRegisters[dmaNum].enable = 0;
+  DmaRegisters[dmaNum].timing = 0;
+  // todo: dreq
+  DmaRegisters[dmaNum].repeat = 0;
+}
+//{                                                               \
+//    vu16 *dmaRegs = (vu16 *)REG_ADDR_DMA##dmaNum;               \
+//    dmaRegs[5] &= ~(DMA_START_MASK | DMA_DREQ_ON | DMA_REPEAT); \
+//    dmaRegs[5] &= ~DMA_ENABLE;                                  \
+//    dmaRegs[5];                                                 \
+//}
+
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "helpers.h"
+
+// a DMA channel, as set up through DmaSet
+struct DmaRegister {
+  enum class Timing {
+    Immediate = 0,
+    VBlank = 1,
+    HBlank = 2,
+    Special = 3,
+  };
+
+  u8 dst_addr_ctrl;
+  u8 src_addr_ctrl;
+  u8 repeat;
+  u8 type;
+  u8 timing;
+  u8 irq;
+  u8 enable;
+  void* src;
+  void* dest;
+  void* initial_dest;  // dest is reset to this after every transfer when dst_addr_ctrl is 3
+  u32 count;
+
+  bool IsPending(Timing pending_timing) const {
+    return enable && static_cast<u32>(pending_timing) == timing;
+  }
+};
+
+namespace dma {
+
+static constexpr u32 NumChannels = 4;
+
+// run the transfers that are waiting for these events
+// HBlank transfers only happen on visible scanlines, once per scanline
+void OnVBlank();
+void OnHBlank();
+
+// channels 1 and 2 with special timing feed the sound FIFOs on hardware, here they are never run,
+// the mixer sends its output straight to the host
+
+// whether any channel is waiting for HBlank
+bool HasHBlankTransfers();
+
+// whether an HBlank transfer writes anything but I/O registers
+// the scanline state can't be worked out ahead of rendering if it does
+bool HBlankTransfersWriteMemory();
+
+}
\ No newline at end of file
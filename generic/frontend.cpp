@@ -1,171 +1,150 @@
 #include "helpers.h"
 #include "frontend.h"
 #include "agb_flash_port.h"
+#include "movie.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "writewatch.h"
+#include "audio.h"
+#include "pacing.h"
 #include "ppu/ppu.h"
 #include "log.h"
-#include <SDL.h>
 
-#include <cstdio>
+#include <chrono>
 
 namespace frontend {
 
-#define WINDOW_TITLE "Pokemon Ruby"
 #define DO_FRAME_COUNTER
 
-SDL_Window* window = nullptr;
-SDL_Renderer* renderer = nullptr;
-SDL_Texture* texture = nullptr;
-SDL_GameController* controller = nullptr;
-
-enum class KeypadButton : u16 {
-  A      = 0x0001,
-  B      = 0x0002,
-  Select = 0x0004,
-  Start  = 0x0008,
-  Right  = 0x0010,
-  Left   = 0x0020,
-  Up     = 0x0040,
-  Down   = 0x0080,
-  R      = 0x0100,
-  L      = 0x0200,
-};
-
 u16 Keypad = 0;
 
 u16 Screen[GbaWidth * GbaHeight];
 
-static void InitGamecontroller() {
-  if (SDL_NumJoysticks() < 0) {
-    printf("No gamepads detected\n");
-  }
-  else {
-    for (int i = 0; i < SDL_NumJoysticks(); i++) {
-      if (SDL_IsGameController(i)) {
-        controller = SDL_GameControllerOpen(i);
-
-        if (!controller) {
-          printf("Failed to connect to gamecontroller at index %d\n", i);
-          continue;
-        }
-
-        printf("Connected game controller at index %d\n", i);
-        return;
-      }
-    }
-  }
-  printf("No gamepads detected (only joysticks)\n");
-}
+static std::unique_ptr<Backend> Host = nullptr;
+static u64 FrameLimit = 0;
+static u64 FrameNumber = 0;
+static std::string LoadStateFile{};
+static std::string SaveStateFile{};
+static bool PipelinedRendering = false;
+
+using Clock = std::chrono::steady_clock;
 
 u64 FrameCounter = 0;
-u64 OldTicks = 0;
-char TitleBuffer[200] = {};
+Clock::time_point OldTicks = {};
+
+void InitFrontend(const Options& options) {
+  // music that follows the host's clock would desync movies
+  // decided before the backend opens the audio device, its callback reads this
+  const bool movie_active = !options.replay_file.empty() || !options.record_file.empty();
+  if (movie_active) audio::SetThreaded(false);
 
-void InitFrontend() {
-  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER)) {
-    log_fatal("Error initializing SDL2: %s", SDL_GetError());
+  if (options.headless) {
+    Host = CreateHeadlessBackend(options);
+  }
+  else {
+    Host = CreateSdlBackend();
+  }
+  FrameLimit    = options.frame_limit;
+  LoadStateFile = options.load_state_file;
+  SaveStateFile = options.save_state_file;
+  PipelinedRendering = options.pipelined_rendering;
+
+  flash::LoadFlashMemory(options.map_save);
+  if (!options.replay_file.empty()) {
+    movie::StartReplay(options.replay_file, options.benchmark);
+  }
+  else if (!options.record_file.empty()) {
+    movie::StartRecording(options.record_file);
   }
 
-  window = SDL_CreateWindow(
-      WINDOW_TITLE,
-      SDL_WINDOWPOS_CENTERED,
-      SDL_WINDOWPOS_CENTERED,
-      Scale * GbaWidth,
-      Scale * GbaHeight,
-      SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI
-  );
-  renderer = SDL_CreateRenderer(
-      window,
-      -1,
-      SDL_RENDERER_ACCELERATED // | SDL_RENDERER_PRESENTVSYNC
-  );
-  texture = SDL_CreateTexture(
-      renderer,
-      SDL_PIXELFORMAT_ABGR1555,
-      SDL_TEXTUREACCESS_STREAMING,
-      GbaWidth,
-      GbaHeight
-  );
-
-  SDL_GL_SetSwapInterval(0);
-  InitGamecontroller();
-
-  flash::LoadFlashMemory();
-  OldTicks = SDL_GetTicks();
+  // and so would going back in time
+  rewinding::SetBudget(movie_active ? 0 : (size_t)options.rewind_megabytes << 20);
+  writewatch::Enable(options.write_watch);
+  OldTicks = Clock::now();
 }
 
 void CloseFrontend() {
-  SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER);
-
-  SDL_DestroyWindow(window);
-  SDL_Quit();
+  Host = nullptr;
 
+  movie::Finish();
+  if (!SaveStateFile.empty()) {
+    savestate::SaveFile(SaveStateFile);
+  }
   flash::DumpFlashMemory();
+  LogUnhandledRegisterAccesses();
+  writewatch::LogReport();
+  writewatch::Disable();
+  audio::LogReport();
 }
 
-void RunFrame() {
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        CloseFrontend();
-        exit(0);
-      case SDL_CONTROLLERBUTTONDOWN: {
-        switch (event.cbutton.button) {
-          case 0: Keypad |= static_cast<u16>(KeypadButton::A); break;
-          case 1: Keypad |= static_cast<u16>(KeypadButton::B); break;
-          case 4: Keypad |= static_cast<u16>(KeypadButton::Select); break;
-          case 6: Keypad |= static_cast<u16>(KeypadButton::Start); break;
-          case 11: Keypad |= static_cast<u16>(KeypadButton::Up); break;
-          case 12: Keypad |= static_cast<u16>(KeypadButton::Down); break;
-          case 13: Keypad |= static_cast<u16>(KeypadButton::Left); break;
-          case 14: Keypad |= static_cast<u16>(KeypadButton::Right); break;
-          case 9: Keypad |= static_cast<u16>(KeypadButton::L); break;
-          case 10: Keypad |= static_cast<u16>(KeypadButton::R); break;
-          default: break;
-        }
-        break;
-      }
-      case SDL_CONTROLLERBUTTONUP: {
-        switch (event.cbutton.button) {
-          case 0: Keypad &= ~static_cast<u16>(KeypadButton::A); break;
-          case 1: Keypad &= ~static_cast<u16>(KeypadButton::B); break;
-          case 4: Keypad &= ~static_cast<u16>(KeypadButton::Select); break;
-          case 6: Keypad &= ~static_cast<u16>(KeypadButton::Start); break;
-          case 11: Keypad &= ~static_cast<u16>(KeypadButton::Up); break;
-          case 12: Keypad &= ~static_cast<u16>(KeypadButton::Down); break;
-          case 13: Keypad &= ~static_cast<u16>(KeypadButton::Left); break;
-          case 14: Keypad &= ~static_cast<u16>(KeypadButton::Right); break;
-          case 9: Keypad &= ~static_cast<u16>(KeypadButton::L); break;
-          case 10: Keypad &= ~static_cast<u16>(KeypadButton::R); break;
-          default: break;
-        }
-        break;
-      }
-      default:
-        break;
-    }
-  }
-
-  ppu::RenderFrame(Screen);
-
+// show the frame, and wait until the next one is due
+static void FinishFrame() {
 #ifdef DO_FRAME_COUNTER
   FrameCounter++;
   if (FrameCounter >= 300) {
-    u64 ticks = SDL_GetTicks();
-    if (ticks - OldTicks >= 1000) {
-      float fps = (1000.0 * (double)FrameCounter) / (double)(ticks - OldTicks);
+    const auto ticks = Clock::now();
+    const double seconds = std::chrono::duration<double>(ticks - OldTicks).count();
+    if (seconds >= 1.0) {
       OldTicks = ticks;
+      Host->ShowFps((float)(FrameCounter / seconds));
       FrameCounter = 0;
-      std::snprintf(TitleBuffer, sizeof(TitleBuffer), WINDOW_TITLE " (%.2f fps)", fps);
-      SDL_SetWindowTitle(window, TitleBuffer);
     }
   }
 #endif
 
-  SDL_RenderClear(renderer);
-  SDL_UpdateTexture(texture, nullptr, (const void *)Screen, sizeof(u16) * GbaWidth);
-  SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-  SDL_RenderPresent(renderer);
+  const u64 frame = FrameNumber++;
+  const bool wants_frame = Host->WantsFrame(frame);
+  if (movie::Benchmarking()) {
+    // benchmarks measure the renderer too, so render frames even if nobody looks at them
+    ppu::RenderFrame(Screen);
+    if (wants_frame) Host->Present(frame, Screen);
+    pacing::EndFrame();
+    return;
+  }
+  if (!wants_frame) {
+    ppu::SkipFrame();
+    pacing::EndFrame();
+    return;
+  }
+
+  if (PipelinedRendering && !Host->ExactFrames()) {
+    Host->Present(frame, ppu::RenderFramePipelined());
+    pacing::EndFrame();
+    return;
+  }
+
+  ppu::RenderFrame(Screen);
+  Host->Present(frame, Screen);
+  pacing::EndFrame();
+}
+
+void RunFrame() {
+  if (!Host->PollInput(FrameNumber) || (FrameLimit && FrameNumber >= FrameLimit)) {
+    CloseFrontend();
+    exit(0);
+  }
+  // the game has to have run up to its first frame before its state can be replaced
+  if (FrameNumber == 0 && !LoadStateFile.empty()) {
+    savestate::LoadFile(LoadStateFile);
+  }
+  if (!movie::ProcessFrame(Keypad)) {
+    CloseFrontend();
+    exit(0);
+  }
+  writewatch::EndFrame();
+
+  if (Host->Rewinding()) {
+    rewinding::StepBack();
+  }
+  else {
+    rewinding::Capture();
+  }
+
+  // nothing in here touches the sound state (the interrupts run while rendering don't play sound),
+  // so the audio thread can run the sound engine in the meantime
+  audio::ReleaseSoundState();
+  FinishFrame();
+  audio::AcquireSoundState();
 }
 
 }
\ No newline at end of file
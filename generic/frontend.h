@@ -1,6 +1,10 @@
 #pragma once
 
 #include "helpers.h"
+#include "writewatch.h"
+
+#include <memory>
+#include <string>
 
 namespace frontend {
 
@@ -8,9 +12,84 @@ static constexpr int Scale = 2;
 static constexpr int GbaWidth = 240;
 static constexpr int GbaHeight = 160;
 
+enum class KeypadButton : u16 {
+  A      = 0x0001,
+  B      = 0x0002,
+  Select = 0x0004,
+  Start  = 0x0008,
+  Right  = 0x0010,
+  Left   = 0x0020,
+  Up     = 0x0040,
+  Down   = 0x0080,
+  R      = 0x0100,
+  L      = 0x0200,
+};
+
 extern u16 Keypad;
 
-void InitFrontend();
+struct Options {
+  // run without a window, for batch runs
+  bool headless = false;
+
+  // headless only: file with the keypad state per frame, see frontend_headless.cpp for the format
+  std::string input_file{};
+  // headless only: write every dump_interval-th frame to this directory, if it is set
+  std::string dump_directory{};
+  u32 dump_interval = 1;
+
+  // render frames on a separate thread while the game runs the next one, see ppu::RenderFramePipelined
+  // this shows frames one frame late, and only pays off when rendering is a large part of the frame
+  bool pipelined_rendering = false;
+
+  // close after this many frames, 0 runs forever
+  u64 frame_limit = 0;
+
+  // use the save file itself as flash memory, see agb_flash_port.h
+  bool map_save = false;
+
+  // record the keypad state to a movie file, or replay it from one, see movie.cpp
+  std::string record_file{};
+  std::string replay_file{};
+  // replay as fast as possible, rendering every frame, and report the frame rate when the movie ends
+  bool benchmark = false;
+
+  // load a save state on the first frame, and save one when closing, see savestate.h
+  std::string load_state_file{};
+  std::string save_state_file{};
+
+  // memory for rewinding, in MiB, 0 disables it
+  u32 rewind_megabytes = 8;
+
+  // catch writes to video memory and I/O registers, see writewatch.h
+  writewatch::Mode write_watch = writewatch::Mode::Off;
+};
+
+// the part of the frontend that deals with the host: input, presentation and the window
+struct Backend {
+  virtual ~Backend() = default;
+
+  // update Keypad, returns false if the frontend should close
+  virtual bool PollInput(u64 frame) = 0;
+
+  // whether the backend wants to see this frame, rendering is skipped if not
+  virtual bool WantsFrame(u64 frame) = 0;
+  virtual void Present(u64 frame, const u16* screen) = 0;
+
+  virtual void ShowFps(float fps) {}
+
+  // whether the user wants to go back in time, checked every frame
+  virtual bool Rewinding() { return false; }
+
+  // whether Present has to get the frame that was just emulated,
+  // instead of the latest frame from the render thread, which lags behind
+  virtual bool ExactFrames() { return false; }
+};
+
+std::unique_ptr<Backend> CreateSdlBackend();
+std::unique_ptr<Backend> CreateHeadlessBackend(const Options& options);
+
+void InitFrontend(const Options& options);
+void CloseFrontend();
 void RunFrame();
 
 }
\ No newline at end of file
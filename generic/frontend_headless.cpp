@@ -0,0 +1,181 @@
+#include "helpers.h"
+#include "frontend.h"
+#include "log.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+#undef max
+#undef min
+
+namespace frontend {
+
+// input files hold one keypad state per line, which is held from that frame on:
+//
+//   # comment
+//   <frame> <buttons>
+//
+// where buttons is a list of button names separated by '+' (A, B, Select, Start, Right, Left, Up, Down, R, L),
+// "none" to release all buttons, or a raw keypad value ("0x0009" for A + Start)
+// lines have to be in frame order
+struct InputEvent {
+  u64 frame;
+  u16 keypad;
+};
+
+static u16 ParseButtons(const char* buttons, const char* file, int line) {
+  if (!std::strncmp(buttons, "0x", 2)) {
+    return (u16)std::strtoul(buttons, nullptr, 16) & 0x03ff;
+  }
+
+  static constexpr struct {
+    const char* name;
+    KeypadButton button;
+  } Names[] = {
+      {"a", KeypadButton::A},
+      {"b", KeypadButton::B},
+      {"select", KeypadButton::Select},
+      {"start", KeypadButton::Start},
+      {"right", KeypadButton::Right},
+      {"left", KeypadButton::Left},
+      {"up", KeypadButton::Up},
+      {"down", KeypadButton::Down},
+      {"r", KeypadButton::R},
+      {"l", KeypadButton::L},
+  };
+
+  u16 keypad = 0;
+  char name[16];
+  const char* c = buttons;
+  while (*c) {
+    size_t length = 0;
+    while (*c && *c != '+' && length < sizeof(name) - 1) {
+      name[length++] = (char)std::tolower((unsigned char)*c++);
+    }
+    name[length] = 0;
+    if (*c == '+') c++;
+
+    if (!std::strcmp(name, "none")) continue;
+
+    bool found = false;
+    for (const auto& entry : Names) {
+      if (!std::strcmp(name, entry.name)) {
+        keypad |= static_cast<u16>(entry.button);
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      log_fatal("%s:%d: unknown button: %s", file, line, name);
+    }
+  }
+  return keypad;
+}
+
+static std::vector<InputEvent> LoadInputFile(const std::string& path) {
+  std::vector<InputEvent> events{};
+
+  FILE* file = std::fopen(path.c_str(), "r");
+  if (!file) {
+    log_fatal("Failed to open input file %s", path.c_str());
+  }
+
+  char buffer[256];
+  int line = 0;
+  while (std::fgets(buffer, sizeof(buffer), file)) {
+    line++;
+    if (char* comment = std::strchr(buffer, '#')) *comment = 0;
+
+    unsigned long long frame;
+    char buttons[128];
+    const int fields = std::sscanf(buffer, "%llu %127s", &frame, buttons);
+    if (fields <= 0) continue;  // empty line
+    if (fields != 2) {
+      log_fatal("%s:%d: expected <frame> <buttons>", path.c_str(), line);
+    }
+    if (!events.empty() && frame < events.back().frame) {
+      log_fatal("%s:%d: frames are out of order", path.c_str(), line);
+    }
+    events.push_back({frame, ParseButtons(buttons, path.c_str(), line)});
+  }
+
+  std::fclose(file);
+  log_info("Loaded %zu input events from %s", events.size(), path.c_str());
+  return events;
+}
+
+// no window, no presentation, input comes from a file
+struct HeadlessBackend final : Backend {
+  explicit HeadlessBackend(const Options& options);
+
+  bool PollInput(u64 frame) override;
+  bool WantsFrame(u64 frame) override;
+  void Present(u64 frame, const u16* screen) override;
+  void ShowFps(float fps) override;
+  bool ExactFrames() override { return true; }
+
+private:
+  std::vector<InputEvent> input{};
+  size_t next_input = 0;
+
+  std::string dump_directory;
+  u32 dump_interval;
+};
+
+HeadlessBackend::HeadlessBackend(const Options& options) :
+    dump_directory(options.dump_directory),
+    dump_interval(std::max<u32>(options.dump_interval, 1)) {
+  if (!options.input_file.empty()) {
+    input = LoadInputFile(options.input_file);
+  }
+  log_info("Running headless");
+}
+
+bool HeadlessBackend::PollInput(u64 frame) {
+  while (next_input < input.size() && input[next_input].frame <= frame) {
+    Keypad = input[next_input++].keypad;
+  }
+  return true;
+}
+
+bool HeadlessBackend::WantsFrame(u64 frame) {
+  // only render frames we dump
+  return !dump_directory.empty() && (frame % dump_interval) == 0;
+}
+
+void HeadlessBackend::Present(u64 frame, const u16* screen) {
+  char path[512];
+  std::snprintf(path, sizeof(path), "%s/frame_%08llu.ppm", dump_directory.c_str(), (unsigned long long)frame);
+
+  FILE* file = std::fopen(path, "wb");
+  if (!file) {
+    log_warn("Failed to open %s for writing", path);
+    return;
+  }
+
+  // binary PPM, BGR555 expanded to RGB888
+  u8 pixels[GbaWidth * GbaHeight * 3];
+  for (int i = 0; i < GbaWidth * GbaHeight; i++) {
+    const u16 color = screen[i];
+    pixels[3 * i + 0] = (u8)((color & 0x001f) << 3);
+    pixels[3 * i + 1] = (u8)(((color >> 5) & 0x001f) << 3);
+    pixels[3 * i + 2] = (u8)(((color >> 10) & 0x001f) << 3);
+  }
+  std::fprintf(file, "P6\n%d %d\n255\n", GbaWidth, GbaHeight);
+  std::fwrite(pixels, 1, sizeof(pixels), file);
+  std::fclose(file);
+}
+
+void HeadlessBackend::ShowFps(float fps) {
+  log_info("%.2f fps", fps);
+}
+
+std::unique_ptr<Backend> CreateHeadlessBackend(const Options& options) {
+  return std::make_unique<HeadlessBackend>(options);
+}
+
+}
\ No newline at end of file
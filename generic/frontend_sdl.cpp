@@ -0,0 +1,214 @@
+#include "helpers.h"
+#include "frontend.h"
+#include "pacing.h"
+#include "savestate.h"
+#include "audio.h"
+#include "log.h"
+#include <SDL.h>
+
+#include <cstdio>
+
+namespace frontend {
+
+#define WINDOW_TITLE "Pokemon Ruby"
+
+struct SdlBackend final : Backend {
+  SdlBackend();
+  ~SdlBackend() override;
+
+  bool PollInput(u64 frame) override;
+  bool WantsFrame(u64 frame) override;
+  void Present(u64 frame, const u16* screen) override;
+  void ShowFps(float fps) override;
+  bool Rewinding() override { return rewinding; }
+
+private:
+  void InitGamecontroller();
+  void OpenAudio();
+
+  SDL_Window* window = nullptr;
+  SDL_Renderer* renderer = nullptr;
+  SDL_Texture* texture = nullptr;
+  SDL_GameController* controller = nullptr;
+  SDL_AudioDeviceID audio_device = 0;
+
+  char title_buffer[200] = {};
+  bool rewinding = false;
+};
+
+void SdlBackend::InitGamecontroller() {
+  if (SDL_NumJoysticks() < 0) {
+    printf("No gamepads detected\n");
+  }
+  else {
+    for (int i = 0; i < SDL_NumJoysticks(); i++) {
+      if (SDL_IsGameController(i)) {
+        controller = SDL_GameControllerOpen(i);
+
+        if (!controller) {
+          printf("Failed to connect to gamecontroller at index %d\n", i);
+          continue;
+        }
+
+        printf("Connected game controller at index %d\n", i);
+        return;
+      }
+    }
+  }
+  printf("No gamepads detected (only joysticks)\n");
+}
+
+void SdlBackend::OpenAudio() {
+  SDL_AudioSpec desired{};
+  desired.freq     = 48000;
+  desired.format   = AUDIO_S16SYS;
+  desired.channels = 2;
+  desired.samples  = (Uint16)audio::DeviceBufferFrames(desired.freq);
+  // runs on SDL's audio thread
+  desired.callback = [](void*, Uint8* stream, int length) {
+    audio::Drain(reinterpret_cast<audio::Frame*>(stream), (u32)length / sizeof(audio::Frame));
+  };
+
+  SDL_AudioSpec obtained{};
+  audio_device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+  if (!audio_device) {
+    log_warn("Error opening audio device: %s", SDL_GetError());
+    return;
+  }
+
+  audio::Open(obtained.freq);
+  SDL_PauseAudioDevice(audio_device, 0);
+}
+
+SdlBackend::SdlBackend() {
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER)) {
+    log_fatal("Error initializing SDL2: %s", SDL_GetError());
+  }
+
+  window = SDL_CreateWindow(
+      WINDOW_TITLE,
+      SDL_WINDOWPOS_CENTERED,
+      SDL_WINDOWPOS_CENTERED,
+      Scale * GbaWidth,
+      Scale * GbaHeight,
+      SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI
+  );
+  renderer = SDL_CreateRenderer(
+      window,
+      -1,
+      SDL_RENDERER_ACCELERATED // | SDL_RENDERER_PRESENTVSYNC
+  );
+  texture = SDL_CreateTexture(
+      renderer,
+      SDL_PIXELFORMAT_ABGR1555,
+      SDL_TEXTUREACCESS_STREAMING,
+      GbaWidth,
+      GbaHeight
+  );
+
+  SDL_GL_SetSwapInterval(0);
+  InitGamecontroller();
+  OpenAudio();
+}
+
+SdlBackend::~SdlBackend() {
+  if (audio_device) {
+    // waits for the callback to finish
+    SDL_CloseAudioDevice(audio_device);
+    audio::Close();
+  }
+  SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER);
+
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+}
+
+bool SdlBackend::PollInput(u64 frame) {
+  SDL_Event event;
+  while (SDL_PollEvent(&event)) {
+    switch (event.type) {
+      case SDL_QUIT:
+        return false;
+      case SDL_CONTROLLERBUTTONDOWN: {
+        switch (event.cbutton.button) {
+          case 0: Keypad |= static_cast<u16>(KeypadButton::A); break;
+          case 1: Keypad |= static_cast<u16>(KeypadButton::B); break;
+          case 4: Keypad |= static_cast<u16>(KeypadButton::Select); break;
+          case 6: Keypad |= static_cast<u16>(KeypadButton::Start); break;
+          case 11: Keypad |= static_cast<u16>(KeypadButton::Up); break;
+          case 12: Keypad |= static_cast<u16>(KeypadButton::Down); break;
+          case 13: Keypad |= static_cast<u16>(KeypadButton::Left); break;
+          case 14: Keypad |= static_cast<u16>(KeypadButton::Right); break;
+          case 9: Keypad |= static_cast<u16>(KeypadButton::L); break;
+          case 10: Keypad |= static_cast<u16>(KeypadButton::R); break;
+          default: break;
+        }
+        break;
+      }
+      case SDL_CONTROLLERBUTTONUP: {
+        switch (event.cbutton.button) {
+          case 0: Keypad &= ~static_cast<u16>(KeypadButton::A); break;
+          case 1: Keypad &= ~static_cast<u16>(KeypadButton::B); break;
+          case 4: Keypad &= ~static_cast<u16>(KeypadButton::Select); break;
+          case 6: Keypad &= ~static_cast<u16>(KeypadButton::Start); break;
+          case 11: Keypad &= ~static_cast<u16>(KeypadButton::Up); break;
+          case 12: Keypad &= ~static_cast<u16>(KeypadButton::Down); break;
+          case 13: Keypad &= ~static_cast<u16>(KeypadButton::Left); break;
+          case 14: Keypad &= ~static_cast<u16>(KeypadButton::Right); break;
+          case 9: Keypad &= ~static_cast<u16>(KeypadButton::L); break;
+          case 10: Keypad &= ~static_cast<u16>(KeypadButton::R); break;
+          default: break;
+        }
+        break;
+      }
+      case SDL_KEYDOWN: {
+        // hold tab to run as fast as possible
+        if (event.key.keysym.sym == SDLK_TAB && !event.key.repeat) pacing::SetTurbo(true);
+        // hold backspace to rewind
+        if (event.key.keysym.sym == SDLK_BACKSPACE) rewinding = true;
+
+        // F1-F9 load a save state slot, shift + F1-F9 saves it
+        if (event.key.keysym.sym >= SDLK_F1 && event.key.keysym.sym < SDLK_F1 + savestate::NumSlots && !event.key.repeat) {
+          const int slot = event.key.keysym.sym - SDLK_F1;
+          if (event.key.keysym.mod & KMOD_SHIFT) {
+            savestate::SaveSlot(slot);
+          }
+          else {
+            savestate::LoadSlot(slot);
+          }
+        }
+        break;
+      }
+      case SDL_KEYUP: {
+        if (event.key.keysym.sym == SDLK_TAB) pacing::SetTurbo(false);
+        if (event.key.keysym.sym == SDLK_BACKSPACE) rewinding = false;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+bool SdlBackend::WantsFrame(u64 frame) {
+  return pacing::ShouldPresentFrame();
+}
+
+void SdlBackend::Present(u64 frame, const u16* screen) {
+  SDL_RenderClear(renderer);
+  SDL_UpdateTexture(texture, nullptr, (const void *)screen, sizeof(u16) * GbaWidth);
+  SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+  SDL_RenderPresent(renderer);
+}
+
+void SdlBackend::ShowFps(float fps) {
+  std::snprintf(title_buffer, sizeof(title_buffer), WINDOW_TITLE " (%.2f fps)", fps);
+  SDL_SetWindowTitle(window, title_buffer);
+}
+
+std::unique_ptr<Backend> CreateSdlBackend() {
+  return std::make_unique<SdlBackend>();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+
+// put the game's globals in sections of their own, so that save states can find them
+// see savestate.cpp for how their bounds are found
+// this has to come before any definitions, it applies to the rest of the file
+#if defined(__clang__)
+#if defined(_WIN32)
+#pragma clang section data="gdata$m" bss="gbss$m"
+#elif defined(__ELF__)
+#pragma clang section data="game_data" bss="game_bss"
+#endif
+#endif
\ No newline at end of file
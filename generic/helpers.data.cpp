@@ -6,12 +6,14 @@ extern "C" {
 u32 intr_check = 0;
 u32 intr_vector = 0;
 
-u8 IORegisters[0x400] = {};
+// page aligned, so that the write watch protects as little else as possible
+// only for 4 KiB pages, writewatch::Enable refuses larger ones
+alignas(0x1000) u8 IORegisters[0x400] = {};
 u8 TrappedIORegisters[0x400] = {};
 
-u8 mem_pltt[0x400] = {};
-u8 mem_vram[0x18000] = {};
-u8 mem_oam[0x400] = {};
+alignas(0x1000) u8 mem_pltt[0x400] = {};
+alignas(0x1000) u8 mem_vram[0x18000] = {};
+alignas(0x1000) u8 mem_oam[0x400] = {};
 u8 mem_ewram[0x40000] = {};
 u8 mem_iwram[0x8000] = {};
 
@@ -18,6 +18,11 @@ extern vu16 gpio_read_enable;
 
 }
 
+// DMA channel state, see dma.h
+struct DmaRegister;
+extern DmaRegister DmaRegisters[4];
+extern const size_t DmaRegistersSize;
+
 enum class Interrupt : u32 {
   VBlank,
   HBlank,
@@ -33,4 +38,7 @@ enum class Interrupt : u32 {
   Dma3,
   Keypad,
   Gamepak
-};
\ No newline at end of file
+};
+
+// accesses to trapped registers that nothing handles are counted, this logs how many there were
+void LogUnhandledRegisterAccesses();
\ No newline at end of file
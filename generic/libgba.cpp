@@ -1,6 +1,8 @@
 #include "helpers.h"
 #include "helpers.libgba.h"
 #include "frontend.h"
+#include "dma.h"
+#include "ppu/ppu.h"
 
 #include <memory>
 #include <cmath>
@@ -93,7 +95,10 @@ void RegisterRamReset(u32 resetFlags) {
 
 void VBlankIntrWait(void) {
   frontend::RunFrame();
+  ppu::StartVBlank();
+  dma::OnVBlank();
   nongeneric::HandleInterrupt(Interrupt::VBlank);
+  ppu::FinishVBlank();
 }
 
 u16 Sqrt(u32 num) {
@@ -110,6 +115,7 @@ u16 ArcTan2(s16 x, s16 y) {
 
 void CpuSet(const void *src, void *dest, u32 control) {
   u32 wordcount = control & 0x001f'ffff;
+  ppu::MarkVramDirty(dest, wordcount * ((control & CPU_SET_32BIT) ? sizeof(u32) : sizeof(u16)));
 
   if (control & CPU_SET_32BIT) {
     if (control & CPU_SET_SRC_FIXED) {
@@ -136,6 +142,9 @@ void CpuSet(const void *src, void *dest, u32 control) {
 #define CPU_FAST_SET_SRC_FIXED 0x01000000
 
 void CpuFastSet(const void *src, void *_dest, u32 control) {
+  // transfers are done in blocks of 8 words
+  ppu::MarkVramDirty(_dest, (((control & 0x1f'ffff) + 7) & ~7) * sizeof(u32));
+
   if (control & CPU_FAST_SET_SRC_FIXED) {
     u32* dest = (u32*)_dest;
     // todo: safe reads
@@ -226,6 +235,7 @@ void LZ77UnCompWram(const void *_src, void *_dest) {
 }
 
 void LZ77UnCompVram(const void *_src, void *_dest) {
+  ppu::MarkVramDirty(_dest, *(u32*)_src >> 8);
   LZ77Uncomp<u16>(_src, _dest);
 }
 
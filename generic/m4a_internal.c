@@ -1,6 +1,12 @@
 #include "gba/m4a_internal.h"
 #include "log.h"
 
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // a lot of work has been done by Kurausukun and atasro2 to port the PokeEmerald m4a engine
 // this can be found at
 // https://github.com/Kurausukun/pokeemerald/blob/pc_port/src/sound_mixer.c
@@ -24,6 +30,9 @@ extern const u8 gClockTable[];
 #define VCOUNT_VBLANK  160
 #define TOTAL_SCANLINES 228
 
+// for save states, which are written in C++
+const size_t SoundInfoSize = sizeof(struct SoundInfo);
+
 extern char SoundMainRAM_Buffer[0x800];
 char SoundMainRAM[sizeof(SoundMainRAM_Buffer)];
 
@@ -31,6 +40,25 @@ char SoundMainRAM[sizeof(SoundMainRAM_Buffer)];
 
 extern void* gMPlayJumpTableTemplate[JUMP_TABLE_SIZE];
 
+// hands the mixer output to the host, see audio.h
+extern void HelperPushSound(const s16* buffer, u32 samples, u32 sample_rate);
+// the rate to mix at in high quality mode, 0 when it is off, see audio.h
+extern u32 HelperHighQualitySoundRate(void);
+// whether SoundMain is left to the audio thread
+extern bool32 HelperSoundThreaded(void);
+// whether this thread may use the sound state right now, see audio::ReleaseSoundState
+extern bool32 HelperHoldsSoundState(void);
+
+#ifndef NDEBUG
+#define CHECK_SOUND_STATE_HELD() do {                              \
+    if (!HelperHoldsSoundState()) {                                \
+      log_fatal("Sound state used while the audio thread has it"); \
+    }                                                              \
+} while (0)
+#else
+#define CHECK_SOUND_STATE_HELD()
+#endif
+
 static u8 ConsumeTrackByte(struct MusicPlayerTrack *track) {
   u8 *ptr = track->cmdPtr++;
   return *ptr;
@@ -525,16 +553,64 @@ static inline bool32 TickEnvelope(struct SoundChannel *chan, struct WaveData *wa
   }
 }
 
+// positions within a wave, and how far they move per output sample, are 9.23 fixed point, like the original mixer
+// mixer->divFreq is 2^23 / pcmFreq, so a channel's frequency in Hz times divFreq is its step
+#define FW_SHIFT 23
+#define FW_MASK ((1u << FW_SHIFT) - 1)
+
+// high quality mode mixes a frame at up to this rate
+#define HQ_MAX_RATE 96000
+#define HQ_MAX_SAMPLES 1664
+
+// channels are mixed into this at 16 bit scale (an s8 sample times an 8 bit volume),
+// and saturated to the output buffers once all of them are in
+static s32 MixBuffer[PCM_DMA_BUF_SIZE * 2];
+
+// the mix at full precision, for the host, interleaved 16 bit stereo
+static s16 HostBuffer[HQ_MAX_SAMPLES * 2];
+
+// the PSG channels for the frame being mixed, at 16 bit scale, interleaved stereo, see GeneratePsg
+static s32 PsgBuffer[HQ_MAX_SAMPLES * 2];
+
+// the inner loops never look at wave boundaries, they get a span of output samples that stays inside the wave,
+// and work out every position from the sample index so the compiler can vectorize them
+
+static inline void MixFixed(s32 *restrict mix, const s8 *restrict current, u32 samples, s32 envR, s32 envL) {
+  for (u32 i = 0; i < samples; i++) {
+    const s32 sample = current[i];
+    mix[2 * i]     += sample * envL;
+    mix[2 * i + 1] += sample * envR;
+  }
+}
+
+// fw + (samples - 1) * step has to fit in 32 bits
+static inline void MixInterpolated(s32 *restrict mix, const s8 *restrict current, u32 samples, u32 fw, u32 step, s32 envR, s32 envL) {
+  for (u32 i = 0; i < samples; i++) {
+    const u32 position = fw + i * step;
+    const s8 *at = current + (position >> FW_SHIFT);
+    const s32 fraction = position & FW_MASK;
+
+    // linear interpolation between this rom sample and the next one
+    const s32 b = at[0];
+    const s32 m = at[1] - b;
+    const s32 sample = b + ((m * fraction) >> FW_SHIFT);
+    mix[2 * i]     += sample * envL;
+    mix[2 * i + 1] += sample * envR;
+  }
+}
+
 //__attribute__((target("thumb")))
-static inline void GenerateAudio(struct SoundInfo *mixer, struct SoundChannel *chan, struct WaveData *wav, s8 *outBuffer, u16 samplesPerFrame, float sampleRateReciprocal) {/*, [[[]]]) {*/
+static inline void SetChannelVolume(struct SoundInfo *mixer, struct SoundChannel *chan) {
   u8 v = chan->envelopeVolume * (mixer->masterVolume + 1) / 16U;
   chan->envelopeVolumeRight = chan->rightVolume * v / 256U;
   chan->envelopeVolumeLeft  = chan->leftVolume * v / 256U;
+}
+
+static inline void GenerateAudio(struct SoundInfo *mixer, struct SoundChannel *chan, struct WaveData *wav, s32 *mix, u16 samplesPerFrame, u32 divFreq) {
+  SetChannelVolume(mixer, chan);
 
   s32 loopLen = 0;
-  s8 *loopStart;
   if (chan->statusFlags & 0x10) {
-    loopStart = wav->data + wav->loopStart;
     loopLen = wav->size - wav->loopStart;
   }
   s32 samplesLeftInWav = chan->count;
@@ -543,81 +619,77 @@ static inline void GenerateAudio(struct SoundInfo *mixer, struct SoundChannel *c
   signed envL = chan->envelopeVolumeLeft;
 #ifdef POKEMON_EXTENSIONS
   if (chan->type & 0x30) {
-    GeneratePokemonSampleAudio(mixer, chan, current, outBuffer, samplesPerFrame, sampleRateReciprocal, samplesLeftInWav, envR, envL, loopLen);
+    GeneratePokemonSampleAudio(mixer, chan, current, mix, samplesPerFrame, divFreq, samplesLeftInWav, envR, envL, loopLen);
+    return;
   }
-  else
 #endif
-  if (chan->type & 8) {
-    for (u16 i = 0; i < samplesPerFrame; i++, outBuffer+=2) {
-      u8 c = *(current++);
-
-      outBuffer[1] += (c * envR) / 32768.0f;
-      outBuffer[0] += (c * envL) / 32768.0f;
-      if (--samplesLeftInWav == 0) {
-        samplesLeftInWav = loopLen;
-        if (loopLen != 0) {
-          current = loopStart;
-        } else {
-          chan->statusFlags = 0;
-          return;
-        }
+
+  // fixed frequency channels play one rom sample per output sample
+  const bool32 fixed = chan->type & 8;
+  const u32 step = fixed ? (1u << FW_SHIFT) : chan->frequency * divFreq;
+  u32 fw = fixed ? 0 : chan->fw & FW_MASK;
+
+  u32 done = 0;
+  while (TRUE) {
+    // past the end, go back by the loop length until we are inside the loop again
+    while (samplesLeftInWav <= 0) {
+      if (loopLen == 0) {
+        chan->statusFlags = 0;
+        return;
       }
+      current -= loopLen;
+      samplesLeftInWav += loopLen;
+    }
+    if (done == samplesPerFrame) {
+      break;
     }
 
-    chan->count = samplesLeftInWav;
-    chan->currentPointer = current;
-  } else {
-    float finePos = chan->fw;
-    float romSamplesPerOutputSample = chan->frequency * sampleRateReciprocal;
-
-    u16 b = current[0];
-    u16 m = current[1] - b;
-    current += 1;
-
-    for (u16 i = 0; i < samplesPerFrame; i++, outBuffer+=2) {
-      // Use linear interpolation to calculate a value between the current sample in the wav
-      // and the next sample. Also cancel out the 9.23 stuff
-      float sample = (finePos * m) + b;
-
-      outBuffer[1] += (sample * envR) / 32768.0f;
-      outBuffer[0] += (sample * envL) / 32768.0f;
-
-      finePos += romSamplesPerOutputSample;
-      u32 newCoarsePos = finePos;
-      if (newCoarsePos != 0) {
-        finePos -= (int)finePos;
-        samplesLeftInWav -= newCoarsePos;
-        if (samplesLeftInWav <= 0) {
-          if (loopLen != 0) {
-            current = loopStart;
-            newCoarsePos = -samplesLeftInWav;
-            samplesLeftInWav += loopLen;
-            while (samplesLeftInWav <= 0) {
-              newCoarsePos -= loopLen;
-              samplesLeftInWav += loopLen;
-            }
-            b = current[newCoarsePos];
-            m = current[newCoarsePos + 1] - b;
-            current += newCoarsePos + 1;
-          } else {
-            chan->statusFlags = 0;
-            return;
-          }
-        } else {
-          b = current[newCoarsePos - 1];
-          m = current[newCoarsePos] - b;
-          current += newCoarsePos;
-        }
-      }
+    u32 samples = samplesPerFrame - done;
+    if (step != 0) {
+      // up to the first output sample that lands past the end of the wave
+      const u64 untilEnd  = (((u64)samplesLeftInWav << FW_SHIFT) - fw + step - 1) / step;
+      const u64 untilWrap = (0xffffffffull - fw) / step + 1;
+      if (samples > untilEnd)  samples = (u32)untilEnd;
+      if (samples > untilWrap) samples = (u32)untilWrap;
     }
 
-    chan->fw = finePos;
-    chan->count = samplesLeftInWav;
-    chan->currentPointer = current - 1;
+    if (fixed) {
+      MixFixed(mix + 2 * done, current, samples, envR, envL);
+    } else {
+      MixInterpolated(mix + 2 * done, current, samples, fw, step, envR, envL);
+    }
+
+    const u64 end = fw + (u64)samples * step;
+    current += end >> FW_SHIFT;
+    samplesLeftInWav -= (s32)(end >> FW_SHIFT);
+    fw = end & FW_MASK;
+    done += samples;
+  }
+
+  chan->fw = fw;
+  chan->count = samplesLeftInWav;
+  chan->currentPointer = current;
+}
+
+// whether the mixer ran past the line the game allows it to
+static inline bool32 OutOfScanlines(u32 scanlineLimit) {
+  if (scanlineLimit == 0) {
+    return FALSE;
   }
+  // todo: fix this
+  vu16 vcount = REG_VCOUNT;
+  if (vcount < VCOUNT_VBLANK) {
+    vcount += TOTAL_SCANLINES;
+  }
+  return vcount >= scanlineLimit;
+}
+
+static inline s32 Saturate(s32 value, s32 min, s32 max) {
+  return value < min ? min : (value > max ? max : value);
 }
 
 void SampleMixer(struct SoundInfo *mixer, u32 scanlineLimit, u16 samplesPerFrame, s8 *outBuffer, u8 dmaCounter, u16 maxBufSize) {
+  s32 *mix = MixBuffer;
   u32 reverb = mixer->reverb;
   if (reverb) {
     // The vanilla reverb effect outputs a mono sound from four sources:
@@ -630,72 +702,694 @@ void SampleMixer(struct SoundInfo *mixer, u32 scanlineLimit, u16 samplesPerFrame
     } else {
       tmp2 = outBuffer + samplesPerFrame * 2;
     }
-    u16 i = 0;
-    do {
+    for (u16 i = 0; i < samplesPerFrame; i++, tmp1 += 2, tmp2 += 2) {
       s32 s = tmp1[0] + tmp1[1] + tmp2[0] + tmp2[1];
-      s *= ((float)reverb / 512.0f);
-      tmp1[0] = tmp1[1] = (u8)s;
-      tmp1+=2;
-      tmp2+=2;
+      s = (s8)((s * (s32)reverb) >> 9);
+      mix[2 * i] = mix[2 * i + 1] = s << 8;
     }
-    while(++i < samplesPerFrame);
   } else {
-    // memset(outBuffer, 0, samplesPerFrame);
-    // memset(outBuffer + maxBufSize, 0, samplesPerFrame);
-    for (int i = 0; i < samplesPerFrame; i++) {
-      s8 *dst = &outBuffer[i*2];
-      dst[1] = dst[0] = 0;
-    }
+    memset(mix, 0, samplesPerFrame * 2 * sizeof(*mix));
   }
 
-  // todo: this might be wrong
-  s32 sampleRateReciprocal = mixer->divFreq;
+  u32 divFreq = mixer->divFreq;
   u8 numChans = mixer->maxChans;
   struct SoundChannel *chan = mixer->chans;
 
   for (int i = 0; i < numChans; i++, chan++) {
     struct WaveData *wav = chan->wav;
 
-    if (scanlineLimit != 0) {
-      // todo: fix this
-      vu16 vcount = REG_VCOUNT;
-      if (vcount < VCOUNT_VBLANK) {
-        vcount += TOTAL_SCANLINES;
-      }
-      if (vcount >= scanlineLimit) {
-        goto returnEarly;
-      }
+    if (OutOfScanlines(scanlineLimit)) {
+      goto returnEarly;
     }
 
     if (TickEnvelope(chan, wav))
     {
 
-      GenerateAudio(mixer, chan, wav, outBuffer, samplesPerFrame, sampleRateReciprocal);
+      GenerateAudio(mixer, chan, wav, mix, samplesPerFrame, divFreq);
     }
   }
   returnEarly:
+  // the game sees the 8 bit output, like the original, the host gets all 16 bits
+  // the PSG is only in the host's, on hardware it never goes through the DMA buffer (and the reverb)
+  for (u32 i = 0; i < samplesPerFrame * 2u; i++) {
+    outBuffer[i]  = (s8)Saturate(mix[i] >> 8, -128, 127);
+    HostBuffer[i] = (s16)Saturate(mix[i] + PsgBuffer[i], -32768, 32767);
+  }
   mixer->ident = MIXER_UNLOCKED;
 }
 
 
-void SoundMain(void) {
-  struct SoundInfo *mixer = SOUND_INFO_PTR;
+// high quality mode: channels are resampled straight to the host rate with a windowed sinc, into a float bus
+// this skips the 8 bit buffer at the game's rate, and the host's own resampling of it
+#define SINC_TAPS 8
+#define SINC_PHASES 256
+#define SINC_PHASE_SHIFT (FW_SHIFT - 8)
+// taps before the position, the rest come after it
+#define SINC_TAPS_BEFORE (SINC_TAPS / 2 - 1)
+// a little under the rom rate's Nyquist frequency, the 8 tap window rolls off slowly
+#define SINC_CUTOFF 0.9
+
+#define CPU_FREQUENCY 16777216
+#define CYCLES_PER_FRAME 280896
+
+// per phase (the position between two rom samples), the weights of the rom samples around it
+static _Alignas(16) float SincKernel[SINC_PHASES][SINC_TAPS];
+static bool32 SincKernelReady = FALSE;
+
+static float HqBus[HQ_MAX_SAMPLES * 2];
+// the last frame, for reverb
+static float HqHistory[HQ_MAX_SAMPLES * 2];
+static u32 HqHistorySamples = 0;
+// the fraction of an output sample left over from the last frame, in CPU cycles * rate
+static u64 HqCycles = 0;
+
+static void InitSincKernel(void) {
+  const double pi = 3.14159265358979323846;
+  for (int phase = 0; phase < SINC_PHASES; phase++) {
+    double weights[SINC_TAPS];
+    double sum = 0;
+    for (int tap = 0; tap < SINC_TAPS; tap++) {
+      // distance from the position to this tap's rom sample, -4 to 4
+      const double x = tap - SINC_TAPS_BEFORE - (double)phase / SINC_PHASES;
+      const double sinc = x == 0 ? 1 : sin(pi * SINC_CUTOFF * x) / (pi * SINC_CUTOFF * x);
+      // Blackman, 0 at the ends
+      const double window = 0.42 + 0.5 * cos(pi * x / (SINC_TAPS / 2)) + 0.08 * cos(2 * pi * x / (SINC_TAPS / 2));
+      weights[tap] = sinc * window;
+      sum += weights[tap];
+    }
+    // constant input comes out unchanged at every phase
+    for (int tap = 0; tap < SINC_TAPS; tap++) {
+      SincKernel[phase][tap] = (float)(weights[tap] / sum);
+    }
+  }
+  SincKernelReady = TRUE;
+}
 
-  if (mixer->ident != MIXER_UNLOCKED) {
+static inline float Convolve(const s8 *taps, const float *kernel) {
+#ifdef __SSE2__
+  // sign extend the 8 rom samples to 32 bits, and convert them to floats
+  const __m128i bytes = _mm_loadl_epi64((const __m128i *)taps);
+  const __m128i words = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+  const __m128 low  = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16));
+  const __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16));
+  __m128 sum = _mm_add_ps(_mm_mul_ps(low, _mm_load_ps(kernel)), _mm_mul_ps(high, _mm_load_ps(kernel + 4)));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+#else
+  float sum = 0;
+  for (int tap = 0; tap < SINC_TAPS; tap++) {
+    sum += taps[tap] * kernel[tap];
+  }
+  return sum;
+#endif
+}
+
+// a rom sample anywhere around the wave, past the end it continues at the loop start, or is silent
+static inline s8 WaveSample(const struct WaveData *wav, s32 offset, s32 loopLen) {
+  if (offset < 0) {
+    return 0;
+  }
+  if (offset >= (s32)wav->size) {
+    if (loopLen == 0) {
+      return 0;
+    }
+    offset = wav->size - loopLen + (offset - wav->size) % loopLen;
+  }
+  return wav->data[offset];
+}
+
+static void GenerateAudioHighQuality(struct SoundInfo *mixer, struct SoundChannel *chan, struct WaveData *wav, float *bus, u32 samples, u32 rate) {
+  SetChannelVolume(mixer, chan);
+
+  s32 loopLen = 0;
+  if (chan->statusFlags & 0x10) {
+    loopLen = wav->size - wav->loopStart;
+  }
+  s32 samplesLeftInWav = chan->count;
+  s8 *current = chan->currentPointer;
+  const float envR = chan->envelopeVolumeRight;
+  const float envL = chan->envelopeVolumeLeft;
+
+  // fixed frequency channels play one rom sample per sample at the game's rate
+  const u32 frequency = (chan->type & 8) ? (u32)mixer->pcmFreq : chan->frequency;
+  const u32 step = (u32)(((u64)frequency << FW_SHIFT) / rate);
+  u32 fw = chan->fw & FW_MASK;
+
+  u32 done = 0;
+  while (TRUE) {
+    while (samplesLeftInWav <= 0) {
+      if (loopLen == 0) {
+        chan->statusFlags = 0;
+        return;
+      }
+      current -= loopLen;
+      samplesLeftInWav += loopLen;
+    }
+    if (done == samples) {
+      break;
+    }
+
+    u32 span = 1;
+    const s32 offset = current - wav->data;
+    if (offset >= SINC_TAPS_BEFORE && samplesLeftInWav > SINC_TAPS / 2) {
+      // all taps are inside the wave up to here, they are read straight from it
+      span = samples - done;
+      if (step != 0) {
+        const u64 untilEdge = (((u64)(samplesLeftInWav - SINC_TAPS / 2) << FW_SHIFT) - fw + step - 1) / step;
+        const u64 untilWrap = (0xffffffffull - fw) / step + 1;
+        if (span > untilEdge) span = (u32)untilEdge;
+        if (span > untilWrap) span = (u32)untilWrap;
+      }
+
+      const s8 *first = current - SINC_TAPS_BEFORE;
+      float *out = bus + 2 * done;
+      for (u32 i = 0; i < span; i++) {
+        const u32 position = fw + i * step;
+        const float sample = Convolve(first + (position >> FW_SHIFT), SincKernel[(position & FW_MASK) >> SINC_PHASE_SHIFT]);
+        out[2 * i]     += sample * envL;
+        out[2 * i + 1] += sample * envR;
+      }
+    } else {
+      // near the start or the end, one sample at a time
+      s8 taps[SINC_TAPS];
+      for (int tap = 0; tap < SINC_TAPS; tap++) {
+        taps[tap] = WaveSample(wav, offset + tap - SINC_TAPS_BEFORE, loopLen);
+      }
+      const float sample = Convolve(taps, SincKernel[fw >> SINC_PHASE_SHIFT]);
+      bus[2 * done]     += sample * envL;
+      bus[2 * done + 1] += sample * envR;
+    }
+
+    const u64 end = fw + (u64)span * step;
+    current += end >> FW_SHIFT;
+    samplesLeftInWav -= (s32)(end >> FW_SHIFT);
+    fw = end & FW_MASK;
+    done += span;
+  }
+
+  chan->fw = fw;
+  chan->count = samplesLeftInWav;
+  chan->currentPointer = current;
+}
+
+// output samples in this frame, VBlanks come every 280896 cycles of the 16.78 MHz CPU
+static u32 HighQualitySamples(u32 rate) {
+  HqCycles += (u64)rate * CYCLES_PER_FRAME;
+  const u32 samples = (u32)(HqCycles / CPU_FREQUENCY);
+  HqCycles %= CPU_FREQUENCY;
+  return samples;
+}
+
+static void SampleMixerHighQuality(struct SoundInfo *mixer, u32 scanlineLimit, u32 samples, u32 rate) {
+  if (!SincKernelReady) {
+    InitSincKernel();
+  }
+
+  float *bus = HqBus;
+  u32 reverb = mixer->reverb;
+  if (reverb && HqHistorySamples) {
+    // the same mono echo of the last frame as the 8 bit mixer
+    for (u32 i = 0; i < samples; i++) {
+      const u32 j = i < HqHistorySamples ? i : HqHistorySamples - 1;
+      bus[2 * i] = bus[2 * i + 1] = (HqHistory[2 * j] + HqHistory[2 * j + 1]) * reverb / 256.0f;
+    }
+  } else {
+    memset(bus, 0, samples * 2 * sizeof(*bus));
+  }
+
+  u8 numChans = mixer->maxChans;
+  struct SoundChannel *chan = mixer->chans;
+
+  for (int i = 0; i < numChans; i++, chan++) {
+    struct WaveData *wav = chan->wav;
+    if (OutOfScanlines(scanlineLimit)) {
+      break;
+    }
+    if (TickEnvelope(chan, wav)) {
+      GenerateAudioHighQuality(mixer, chan, wav, bus, samples, rate);
+    }
+  }
+
+  for (u32 i = 0; i < samples * 2; i++) {
+    const float value = bus[i] + PsgBuffer[i];
+    HostBuffer[i] = value <= -32768.0f ? -32768 : (value >= 32767.0f ? 32767 : (s16)value);
+  }
+  memcpy(HqHistory, bus, samples * 2 * sizeof(*bus));
+  HqHistorySamples = samples;
+  mixer->ident = MIXER_UNLOCKED;
+}
+
+// the PSG: the CGB channels (2 squares, the wave channel and noise), synthesized from their registers
+// CgbSound drives them like it would on hardware, it writes frequencies, envelopes and restart bits once a frame
+// every change in a channel's output is a step, each step goes into a buffer as a band-limited impulse (a BLEP),
+// and the buffer is summed up into levels once per block, so the cost is per step rather than per sample,
+// and the edges of the square waves come out without aliasing at any rate
+#define BLEP_TAPS 16
+#define BLEP_PHASE_BITS 5
+#define BLEP_PHASES (1 << BLEP_PHASE_BITS)
+// every phase of the kernel sums to this, a step is at its full height once its impulse has gone by
+#define BLEP_SHIFT 15
+#define BLEP_CUTOFF 0.9
+
+// times within a block are output samples from its start, 32.32 fixed point
+// a CPU cycle is rate / 2^24 output samples, which is rate << 8 in these units
+#define PSG_TIME(cycles, rate) ((u64)(cycles) * ((u64)(rate) << 8))
+// the frame sequencer clocks lengths, sweeps and envelopes 512 times a second
+#define PSG_SEQUENCER_CYCLES (CPU_FREQUENCY / 512)
+
+enum {
+  PSG_SQUARE1,
+  PSG_SQUARE2,
+  PSG_WAVE,
+  PSG_NOISE,
+  PSG_CHANNELS,
+};
+
+struct PsgChannel {
+  bool32 on;
+  bool32 lengthEnabled;
+  // too fast to hear, the waveform is above the Nyquist frequency, and comes out as its average level
+  bool32 steady;
+  u64 period;     // time between waveform steps
+  u64 next;       // time of the next waveform step
+  u32 position;   // duty step or wave sample, the LFSR for noise
+  u32 length;
+  u32 volume;     // 0 to 15, from the envelope
+  u32 envelopeStep;
+  u32 envelopeTimer;
+  bool32 envelopeUp;
+  u32 sweepTimer;
+  u8 duty;        // squares, 12.5%, 25%, 50% or 75%
+  u8 waveVolume;  // wave, in quarters
+  bool8 narrow;   // noise, 7 bit LFSR
+  // the level last put into the step buffers, after panning and master volume
+  s32 left;
+  s32 right;
+  s32 scaleLeft;
+  s32 scaleRight;
+};
+
+// bit n is the output at duty step n, for 12.5%, 25%, 50% and 75%
+static const u8 PsgDutyPatterns[4] = {0x80, 0x81, 0xe1, 0x7e};
+// their average levels, in volume steps
+static const s8 PsgDutyAverages[4] = {-3, -2, 0, 2};
+// SOUNDCNT_H, PSG at 25%, 50% and 100%
+static const u8 PsgRatios[4] = {2, 4, 8, 0};
+// SOUND3CNT_H, muted, 100%, 50% and 25%, in quarters
+static const u8 PsgWaveVolumes[4] = {0, 4, 2, 1};
+
+// per phase (where the step falls between two output samples), the impulse it makes
+static s32 BlepKernel[BLEP_PHASES][BLEP_TAPS];
+static bool32 BlepKernelReady = FALSE;
+
+static struct PsgChannel PsgChannels[PSG_CHANNELS];
+static u32 PsgRate = 0;
+static u64 PsgSequencerTime = 0;
+static u32 PsgSequencerStep = 0;
+// square 1's frequency with the sweeps applied, and SOUND1CNT_X's as it was last read or written back
+// 0x800 is no frequency, so the register is read first
+static u32 PsgSweptFrequency = 0;
+static u32 PsgRegisterFrequency = 0x800;
+// register writes for the game thread to make, see SoundApplyRegisterWrites
+static bool32 PsgSweepPending = FALSE;
+static u16 PsgStatus = 0;
+static bool32 PsgStatusPending = FALSE;
+// wave RAM as signed levels, 2 per byte, and their sum
+static s32 PsgWave[32];
+static s32 PsgWaveSum = 0;
+
+// the impulses of the last steps of a block reach into the next one
+static s32 PsgSteps[(HQ_MAX_SAMPLES + BLEP_TAPS) * 2];
+static s32 PsgSumLeft = 0;
+static s32 PsgSumRight = 0;
+
+static void InitBlepKernel(void) {
+  const double pi = 3.14159265358979323846;
+  for (int phase = 0; phase < BLEP_PHASES; phase++) {
+    double weights[BLEP_TAPS];
+    double sum = 0;
+    for (int tap = 0; tap < BLEP_TAPS; tap++) {
+      // distance from the step, which is delayed by half the taps so the impulse fits on both sides
+      const double x = tap - BLEP_TAPS / 2 - (phase + 0.5) / BLEP_PHASES;
+      const double sinc = sin(pi * BLEP_CUTOFF * x) / (pi * BLEP_CUTOFF * x);
+      const double window = fabs(x) >= BLEP_TAPS / 2 ? 0 : 0.42 + 0.5 * cos(pi * x / (BLEP_TAPS / 2)) + 0.08 * cos(2 * pi * x / (BLEP_TAPS / 2));
+      weights[tap] = sinc * window;
+      sum += weights[tap];
+    }
+    // rounding is made up for at the peak, so levels come out exact
+    s32 total = 0;
+    int peak = 0;
+    for (int tap = 0; tap < BLEP_TAPS; tap++) {
+      BlepKernel[phase][tap] = (s32)lround(weights[tap] / sum * (1 << BLEP_SHIFT));
+      total += BlepKernel[phase][tap];
+      if (BlepKernel[phase][tap] > BlepKernel[phase][peak]) {
+        peak = tap;
+      }
+    }
+    BlepKernel[phase][peak] += (1 << BLEP_SHIFT) - total;
+  }
+  BlepKernelReady = TRUE;
+}
+
+// both sides at once, they share the kernel
+static inline void PsgAddStep(u64 time, s32 left, s32 right) {
+  const s32 *restrict kernel = BlepKernel[(u32)time >> (32 - BLEP_PHASE_BITS)];
+  s32 *restrict out = PsgSteps + 2 * (u32)(time >> 32);
+  for (int tap = 0; tap < BLEP_TAPS; tap++) {
+    out[2 * tap]     += left * kernel[tap];
+    out[2 * tap + 1] += right * kernel[tap];
+  }
+}
+
+// the output before panning, in quarters of a volume step, -60 to 60
+static s32 PsgLevel(const struct PsgChannel *ch, int index) {
+  if (!ch->on) {
+    return 0;
+  }
+  const s32 volume = ch->volume;
+  switch (index) {
+  case PSG_WAVE:
+    if (ch->steady) {
+      return PsgWaveSum * ch->waveVolume / 32;
+    }
+    return PsgWave[ch->position] * ch->waveVolume;
+  case PSG_NOISE:
+    return (ch->position & 1) ? -4 * volume : 4 * volume;
+  default:
+    if (ch->steady) {
+      return volume * PsgDutyAverages[ch->duty];
+    }
+    return ((PsgDutyPatterns[ch->duty] >> ch->position) & 1) ? 4 * volume : -4 * volume;
+  }
+}
+
+static inline void PsgUpdate(struct PsgChannel *ch, int index, u64 time) {
+  const s32 level = PsgLevel(ch, index);
+  const s32 left  = level * ch->scaleLeft;
+  const s32 right = level * ch->scaleRight;
+  if (left != ch->left || right != ch->right) {
+    PsgAddStep(time, left - ch->left, right - ch->right);
+    ch->left = left;
+    ch->right = right;
+  }
+}
+
+static inline void PsgStep(struct PsgChannel *ch, int index) {
+  switch (index) {
+  case PSG_WAVE:
+    ch->position = (ch->position + 1) & 31;
+    break;
+  case PSG_NOISE: {
+    const u32 bit = (ch->position ^ (ch->position >> 1)) & 1;
+    ch->position = (ch->position >> 1) | (bit << 14);
+    if (ch->narrow) {
+      ch->position = (ch->position & ~0x40u) | (bit << 6);
+    }
+    break;
+  }
+  default:
+    ch->position = (ch->position + 1) & 7;
+    break;
+  }
+}
+
+// step the waveform up to end
+static void PsgRun(struct PsgChannel *ch, int index, u64 end) {
+  if (!ch->on || ch->steady) {
+    ch->next = end;
     return;
   }
-  mixer->ident = MIXER_LOCKED;
+  while (ch->next < end) {
+    u64 time = ch->next;
+    PsgStep(ch, index);
+    if (index == PSG_NOISE) {
+      // noise can step many times per output sample, only the last step in a sample makes it out
+      while (time + ch->period < end && ((time + ch->period) >> 32) == (time >> 32)) {
+        time += ch->period;
+        PsgStep(ch, index);
+      }
+    }
+    PsgUpdate(ch, index, time);
+    ch->next = time + ch->period;
+  }
+}
 
-  u32 maxLines = mixer->maxLines;
-  if (mixer->maxLines != 0) {
-    // todo: fix this
-    u32 vcount = REG_VCOUNT;
-    maxLines += vcount;
-    if (vcount < VCOUNT_VBLANK) {
-      maxLines += TOTAL_SCANLINES;
+static void PsgSetFrequency(struct PsgChannel *ch, int index, u32 value, u32 rate) {
+  switch (index) {
+  case PSG_WAVE:
+    ch->period = PSG_TIME(8 * (2048 - (value & 0x7ff)), rate);
+    // 32 steps per cycle, at up to half a cycle per output sample
+    ch->steady = ch->period <= (1ull << 28);
+    break;
+  case PSG_NOISE: {
+    // 524288 Hz / r / 2^(s+1), r = 0 counts as 0.5
+    const u32 r = value & 7;
+    const u32 s = (value >> 4) & 15;
+    ch->period = PSG_TIME(r ? r << (s + 6) : 1u << (s + 5), rate);
+    ch->narrow = (value & 8) != 0;
+    break;
+  }
+  default:
+    ch->period = PSG_TIME(16 * (2048 - (value & 0x7ff)), rate);
+    ch->steady = ch->period <= (1ull << 30);
+    break;
+  }
+}
+
+// a restart, from the channel's length and envelope register
+static void PsgTrigger(struct PsgChannel *ch, int index, u32 envelope) {
+  ch->on = TRUE;
+  ch->next = ch->period;
+  if (index == PSG_WAVE) {
+    ch->length = 256 - (envelope & 0xff);
+    ch->position = 0;
+    return;
+  }
+  ch->length = 64 - (envelope & 0x3f);
+  ch->volume = envelope >> 12;
+  ch->envelopeStep = (envelope >> 8) & 7;
+  ch->envelopeTimer = ch->envelopeStep;
+  ch->envelopeUp = (envelope & 0x800) != 0;
+  if (index == PSG_NOISE) {
+    ch->position = 0x7fff;
+  }
+  if (index == PSG_SQUARE1) {
+    const u32 time = (REG_SOUND1CNT_L >> 4) & 7;
+    ch->sweepTimer = time ? time : 8;
+  }
+}
+
+// the swept frequency lives on until CgbSound (or the game) writes a new one, or restarts the note
+static u32 PsgSquare1Frequency(u16 value) {
+  const u32 frequency = value & 0x7ff;
+  if (frequency != PsgRegisterFrequency || (value & 0x8000)) {
+    PsgSweptFrequency = PsgRegisterFrequency = frequency;
+    PsgSweepPending = FALSE;
+  }
+  return PsgSweptFrequency;
+}
+
+static void PsgReadChannel(struct PsgChannel *ch, int index, u32 envelope, vu16 *control, u32 rate) {
+  const u16 value = *control;
+  ch->lengthEnabled = (value & 0x4000) != 0;
+  PsgSetFrequency(ch, index, index == PSG_SQUARE1 ? PsgSquare1Frequency(value) : value, rate);
+  if (value & 0x8000) {
+    // the restart bit reads back as 0 on hardware
+    // unlike the other write backs, this one is not queued: it takes back CgbSound's write on this same thread,
+    // left set, the note would restart every frame until the game thread has the state again
+    *control = value & ~0x8000;
+    PsgTrigger(ch, index, envelope);
+  }
+  // the DAC is off with a silent, decreasing envelope
+  if (index != PSG_WAVE && (envelope & 0xf800) == 0) {
+    ch->on = FALSE;
+  }
+}
+
+static void PsgReadRegisters(u32 rate) {
+  const u16 envelope1 = REG_SOUND1CNT_H;
+  const u16 envelope2 = REG_SOUND2CNT_L;
+  PsgChannels[PSG_SQUARE1].duty = (envelope1 >> 6) & 3;
+  PsgChannels[PSG_SQUARE2].duty = (envelope2 >> 6) & 3;
+  PsgReadChannel(&PsgChannels[PSG_SQUARE1], PSG_SQUARE1, envelope1, &REG_SOUND1CNT_X, rate);
+  PsgReadChannel(&PsgChannels[PSG_SQUARE2], PSG_SQUARE2, envelope2, &REG_SOUND2CNT_H, rate);
+  PsgReadChannel(&PsgChannels[PSG_NOISE], PSG_NOISE, REG_SOUND4CNT_L, &REG_SOUND4CNT_H, rate);
+
+  // the 64 sample mode of the wave channel is not supported, MP2K only ever plays one bank
+  struct PsgChannel *wave = &PsgChannels[PSG_WAVE];
+  const u16 waveVolume = REG_SOUND3CNT_H;
+  // 75% is a separate bit
+  wave->waveVolume = (waveVolume & 0x8000) ? 3 : PsgWaveVolumes[(waveVolume >> 13) & 3];
+  PsgReadChannel(wave, PSG_WAVE, waveVolume, &REG_SOUND3CNT_X, rate);
+  if (!(REG_SOUND3CNT_L & 0x80)) {
+    wave->on = FALSE;
+  }
+  const vu8 *waveRam = (const vu8 *)&REG_WAVE_RAM0;
+  PsgWaveSum = 0;
+  for (int i = 0; i < 16; i++) {
+    const u8 value = waveRam[i];
+    PsgWave[2 * i]     = 2 * (value >> 4) - 15;
+    PsgWave[2 * i + 1] = 2 * (value & 0xf) - 15;
+    PsgWaveSum += PsgWave[2 * i] + PsgWave[2 * i + 1];
+  }
+
+  // master volume and panning, SOUNDCNT_L is NR50 and NR51
+  const u16 output = REG_SOUNDCNT_L;
+  const s32 ratio = (REG_SOUNDCNT_X & 0x80) ? PsgRatios[REG_SOUNDCNT_H & 3] : 0;
+  for (int i = 0; i < PSG_CHANNELS; i++) {
+    struct PsgChannel *ch = &PsgChannels[i];
+    ch->scaleRight = (output & (0x100 << i))  ? ((output & 7) + 1) * ratio : 0;
+    ch->scaleLeft  = (output & (0x1000 << i)) ? (((output >> 4) & 7) + 1) * ratio : 0;
+    PsgUpdate(ch, i, 0);
+  }
+}
+
+static void PsgSweep(struct PsgChannel *ch, u32 rate) {
+  if (--ch->sweepTimer != 0) {
+    return;
+  }
+  const u16 sweep = REG_SOUND1CNT_L;
+  const u32 time = (sweep >> 4) & 7;
+  const u32 shift = sweep & 7;
+  ch->sweepTimer = time ? time : 8;
+  if (time == 0) {
+    return;
+  }
+
+  const u32 frequency = PsgSweptFrequency;
+  const u32 change = frequency >> shift;
+  if (!(sweep & 8) && frequency + change > 0x7ff) {
+    ch->on = FALSE;
+    return;
+  }
+  if (shift != 0) {
+    // written back to the register like on hardware, once the game thread has the state
+    const u32 swept = (sweep & 8) ? frequency - change : frequency + change;
+    PsgSweptFrequency = swept;
+    PsgSweepPending = TRUE;
+    PsgSetFrequency(ch, PSG_SQUARE1, swept, rate);
+  }
+}
+
+// lengths at 256 Hz, the sweep at 128 Hz, envelopes at 64 Hz
+static void PsgClockSequencer(u64 time, u32 rate) {
+  const u32 step = PsgSequencerStep++ & 7;
+  for (int i = 0; i < PSG_CHANNELS; i++) {
+    struct PsgChannel *ch = &PsgChannels[i];
+    if (!ch->on) {
+      continue;
+    }
+    if ((step & 1) == 0 && ch->lengthEnabled && --ch->length == 0) {
+      ch->on = FALSE;
+    }
+    if (i == PSG_SQUARE1 && (step & 3) == 2) {
+      PsgSweep(ch, rate);
+    }
+    if (step == 7 && i != PSG_WAVE && ch->envelopeStep != 0 && --ch->envelopeTimer == 0) {
+      ch->envelopeTimer = ch->envelopeStep;
+      if (ch->envelopeUp && ch->volume < 15) {
+        ch->volume++;
+      } else if (!ch->envelopeUp && ch->volume > 0) {
+        ch->volume--;
+      }
+    }
+    PsgUpdate(ch, i, time);
+  }
+}
+
+// a block of the PSG channels into PsgBuffer, called after CgbSound, before the mixer adds them to its bus
+static void GeneratePsg(u32 samples, u32 rate) {
+  if (!BlepKernelReady) {
+    InitBlepKernel();
+  }
+  if (samples > HQ_MAX_SAMPLES) {
+    samples = HQ_MAX_SAMPLES;
+  }
+  if (rate != PsgRate) {
+    // switching between the mixers, times are in the wrong units, notes keep playing from silence
+    for (int i = 0; i < PSG_CHANNELS; i++) {
+      PsgChannels[i].next = 0;
+      PsgChannels[i].left = PsgChannels[i].right = 0;
+    }
+    memset(PsgSteps, 0, sizeof(PsgSteps));
+    PsgSumLeft = PsgSumRight = 0;
+    PsgSequencerTime = 0;
+    PsgRate = rate;
+  }
+
+  PsgReadRegisters(rate);
+
+  // the channels only change between waveform steps, or when the sequencer clocks them
+  const u64 end = (u64)samples << 32;
+  u64 time = 0;
+  while (time < end) {
+    const u64 until = PsgSequencerTime < end ? PsgSequencerTime : end;
+    for (int i = 0; i < PSG_CHANNELS; i++) {
+      PsgRun(&PsgChannels[i], i, until);
+    }
+    time = until;
+    if (time == PsgSequencerTime) {
+      PsgClockSequencer(time, rate);
+      PsgSequencerTime += PSG_TIME(PSG_SEQUENCER_CYCLES, rate);
     }
   }
 
+  for (u32 i = 0; i < samples; i++) {
+    PsgSumLeft  += PsgSteps[2 * i];
+    PsgSumRight += PsgSteps[2 * i + 1];
+    PsgBuffer[2 * i]     = PsgSumLeft >> BLEP_SHIFT;
+    PsgBuffer[2 * i + 1] = PsgSumRight >> BLEP_SHIFT;
+  }
+  memmove(PsgSteps, PsgSteps + 2 * samples, 2 * BLEP_TAPS * sizeof(*PsgSteps));
+  memset(PsgSteps + 2 * BLEP_TAPS, 0, 2 * samples * sizeof(*PsgSteps));
+
+  u16 status = 0;
+  for (int i = 0; i < PSG_CHANNELS; i++) {
+    PsgChannels[i].next -= end;
+    if (PsgChannels[i].on) {
+      status |= 1 << i;
+    }
+  }
+  PsgSequencerTime -= end;
+  PsgStatus = status;
+  PsgStatusPending = TRUE;
+}
+
+// the PSG's register writes, the sweep's frequency and the channel status bits in SOUNDCNT_X
+// the game thread makes them, after SoundMain, or when it takes the sound state back from the audio thread,
+// so that nothing but game code writes the registers while the game runs
+void SoundApplyRegisterWrites(void) {
+  CHECK_SOUND_STATE_HELD();
+  if (PsgSweepPending) {
+    REG_SOUND1CNT_X = (REG_SOUND1CNT_X & ~0x7ff) | PsgSweptFrequency;
+    PsgRegisterFrequency = PsgSweptFrequency;
+    PsgSweepPending = FALSE;
+  }
+  if (PsgStatusPending) {
+    REG_SOUNDCNT_X = (REG_SOUNDCNT_X & ~0xf) | PsgStatus;
+    PsgStatusPending = FALSE;
+  }
+}
+
+// after a save state is loaded, none of the host side sound state belongs to the restored game
+// the PSG channels are not in the state, held notes would keep sounding,
+// so they start out silent, with their status bits in SOUNDCNT_X cleared to match
+void SoundResetHostState(void) {
+  memset(PsgChannels, 0, sizeof(PsgChannels));
+  // the next block starts over from an empty step buffer and sequencer
+  PsgRate = 0;
+  PsgSequencerStep = 0;
+  PsgRegisterFrequency = 0x800;
+  PsgSweepPending = FALSE;
+  PsgStatusPending = FALSE;
+  REG_SOUNDCNT_X &= ~0xf;
+
+  HqCycles = 0;
+  HqHistorySamples = 0;
+}
+
+static void RunSoundFrame(struct SoundInfo *mixer, u32 maxLines) {
   if (mixer->MPlayMainHead != NULL) {
     mixer->MPlayMainHead(mixer->musicPlayerHead);
   }
@@ -711,11 +1405,60 @@ void SoundMain(void) {
 //    outBuffer += samplesPerFrame * (mixer->pcmDmaPeriod - (dmaCounter - 1)) * 2;
 //  }
 
-  //MixerRamFunc mixerRamFunc = ((MixerRamFunc)MixerCodeBuffer);
-  SampleMixer(mixer, maxLines, samplesPerFrame, outBuffer, dmaCounter, PCM_DMA_BUF_SIZE);
-#ifdef PORTABLE
-  cgb_audio_generate(samplesPerFrame);
-#endif
+  const u32 hqRate = HelperHighQualitySoundRate();
+  if (hqRate != 0 && hqRate <= HQ_MAX_RATE) {
+    const u32 hqSamples = HighQualitySamples(hqRate);
+    GeneratePsg(hqSamples, hqRate);
+    SampleMixerHighQuality(mixer, maxLines, hqSamples, hqRate);
+    HelperPushSound(HostBuffer, hqSamples, hqRate);
+  } else {
+    GeneratePsg(samplesPerFrame, mixer->pcmFreq);
+    //MixerRamFunc mixerRamFunc = ((MixerRamFunc)MixerCodeBuffer);
+    SampleMixer(mixer, maxLines, samplesPerFrame, outBuffer, dmaCounter, PCM_DMA_BUF_SIZE);
+    HelperPushSound(HostBuffer, samplesPerFrame, mixer->pcmFreq);
+  }
+}
+
+void SoundMain(void) {
+  CHECK_SOUND_STATE_HELD();
+  // the audio thread runs the frames instead, see SoundMainThreaded
+  if (HelperSoundThreaded()) {
+    return;
+  }
+
+  struct SoundInfo *mixer = SOUND_INFO_PTR;
+
+  if (mixer->ident != MIXER_UNLOCKED) {
+    return;
+  }
+  mixer->ident = MIXER_LOCKED;
+
+  u32 maxLines = mixer->maxLines;
+  if (mixer->maxLines != 0) {
+    // todo: fix this
+    u32 vcount = REG_VCOUNT;
+    maxLines += vcount;
+    if (vcount < VCOUNT_VBLANK) {
+      maxLines += TOTAL_SCANLINES;
+    }
+  }
+
+  RunSoundFrame(mixer, maxLines);
+  SoundApplyRegisterWrites();
+}
+
+// a frame of sound on the host's audio thread, while the game thread has handed it the sound state
+void SoundMainThreaded(void) {
+  CHECK_SOUND_STATE_HELD();
+  struct SoundInfo *mixer = SOUND_INFO_PTR;
+
+  if (mixer == NULL || mixer->ident != MIXER_UNLOCKED) {
+    return;
+  }
+  mixer->ident = MIXER_LOCKED;
+
+  // the scanline limit is a budget for the GBA's CPU, VCOUNT means nothing on this thread
+  RunSoundFrame(mixer, 0);
 }
 
 void SoundMainBTM(void* dest) {
@@ -723,6 +1466,7 @@ void SoundMainBTM(void* dest) {
 }
 
 void TrackStop(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track) {
+  CHECK_SOUND_STATE_HELD();
   if (track->flags & 0x80) {
     for (struct SoundChannel *chan = track->chan; chan != NULL; chan = chan->nextChannelPointer) {
       if (chan->statusFlags != 0) {
@@ -740,6 +1484,7 @@ void TrackStop(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track
 }
 
 void MPlayMain(struct MusicPlayerInfo * player) {
+  CHECK_SOUND_STATE_HELD();
   struct SoundInfo *info = SOUND_INFO_PTR;
 
   if (player->ident != PLAYER_UNLOCKED) {
@@ -927,10 +1672,11 @@ void RealClearChain(void* x) {
 }
 
 void m4aSoundVSync(void) {
+  CHECK_SOUND_STATE_HELD();
   // in the original code, the ID number is checked (Smsh)
   // we skip this as we know the game has this identifier
 
-  // Decrement the PCM DMA counter. If it reaches 0, we need to do a DMA.
+  // Decrement the PCM DMA counter. If it reaches 0, the original code restarts the sound DMAs.
   if (--sound_info->pcmDmaCounter != 0) {
     return;
   }
@@ -938,28 +1684,5 @@ void m4aSoundVSync(void) {
   // Reload the PCM DMA counter.
   sound_info->pcmDmaCounter = sound_info->pcmDmaPeriod;
 
-  // todo: HLE
-  return;
-  const u32 dma1cnt_h = REG_DMA1CNT_H;
-  if (dma1cnt_h & DMA_REPEAT) {
-    // 	ldr r1, =((DMA_ENABLE | DMA_START_NOW | DMA_32BIT | DMA_SRC_INC | DMA_DEST_FIXED) << 16) | 4
-    //	str r1, [r2, 0x8] @ DMA1CNT
-    log_warn("Do m4a vsync DMA 1");
-  }
-
-  const u32 dma2cnt_h = REG_DMA1CNT_H;
-  if (dma2cnt_h & DMA_REPEAT) {
-    //  ldr r1, =((DMA_ENABLE | DMA_START_NOW | DMA_32BIT | DMA_SRC_INC | DMA_DEST_FIXED) << 16) | 4
-    //	str r1, [r2, 0xC + 0x8] @ DMA2CNT
-    log_warn("Do m4a vsync DMA 2");
-  }
-
-  // turn off DMA1/DMA2
-  REG_DMA1CNT_H = DMA_32BIT;
-  REG_DMA2CNT_H = DMA_32BIT;
-
-  // enable sound FIFO
-  // LSB is 0, so DMA_SRC_INC is used (destination is always fixed in FIFO mode)
-  REG_DMA1CNT_H = (DMA_ENABLE | DMA_START_SPECIAL | DMA_32BIT | DMA_REPEAT);
-  REG_DMA2CNT_H = (DMA_ENABLE | DMA_START_SPECIAL | DMA_32BIT | DMA_REPEAT);
+  // the mixer output goes straight to the host from SoundMain, there is no FIFO to feed
 }
\ No newline at end of file
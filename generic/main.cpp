@@ -1,12 +1,114 @@
 #include "log.h"
 #include "frontend.h"
+#include "pacing.h"
+#include "audio.h"
+
+#include <cstring>
+#include <cstdlib>
 
 extern "C" void AgbMain();
 
 
+static frontend::Options ParseArguments(int argc, char** argv) {
+  frontend::Options options{};
+  bool speed_set = false;
+  bool rewind_set = false;
+
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--speed") && has_value) {
+      // multiplier on the GBA frame rate, 0 for unlimited
+      pacing::SetSpeed(std::atof(argv[++i]));
+      speed_set = true;
+    }
+    else if (!std::strcmp(argv[i], "--frameskip") && has_value) {
+      pacing::SetMaxFrameSkip(std::atoi(argv[++i]));
+    }
+    else if (!std::strcmp(argv[i], "--audio-latency") && has_value) {
+      // milliseconds of sound queued up ahead of the host
+      audio::SetLatency(std::atoi(argv[++i]));
+    }
+    else if (!std::strcmp(argv[i], "--hq-sound")) {
+      // mix at the device rate with windowed sinc interpolation
+      audio::SetHighQuality(true);
+    }
+    else if (!std::strcmp(argv[i], "--audio-thread")) {
+      // run the music and the mixer on the audio device's clock
+      audio::SetThreaded(true);
+    }
+    else if (!std::strcmp(argv[i], "--pipelined")) {
+      options.pipelined_rendering = true;
+    }
+    else if (!std::strcmp(argv[i], "--headless")) {
+      options.headless = true;
+    }
+    else if (!std::strcmp(argv[i], "--input") && has_value) {
+      options.input_file = argv[++i];
+    }
+    else if (!std::strcmp(argv[i], "--dump-frames") && has_value) {
+      options.dump_directory = argv[++i];
+    }
+    else if (!std::strcmp(argv[i], "--dump-interval") && has_value) {
+      options.dump_interval = std::atoi(argv[++i]);
+    }
+    else if (!std::strcmp(argv[i], "--frames") && has_value) {
+      options.frame_limit = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if (!std::strcmp(argv[i], "--map-save")) {
+      options.map_save = true;
+    }
+    else if (!std::strcmp(argv[i], "--record") && has_value) {
+      options.record_file = argv[++i];
+    }
+    else if (!std::strcmp(argv[i], "--replay") && has_value) {
+      options.replay_file = argv[++i];
+    }
+    else if (!std::strcmp(argv[i], "--benchmark")) {
+      options.benchmark = true;
+    }
+    else if (!std::strcmp(argv[i], "--load-state") && has_value) {
+      options.load_state_file = argv[++i];
+    }
+    else if (!std::strcmp(argv[i], "--save-state") && has_value) {
+      options.save_state_file = argv[++i];
+    }
+    else if (!std::strcmp(argv[i], "--rewind") && has_value) {
+      options.rewind_megabytes = std::atoi(argv[++i]);
+      rewind_set = true;
+    }
+    else if (!std::strcmp(argv[i], "--write-watch") && has_value) {
+      const char* mode = argv[++i];
+      if (!std::strcmp(mode, "pages")) options.write_watch = writewatch::Mode::Pages;
+      else if (!std::strcmp(mode, "writes")) options.write_watch = writewatch::Mode::Writes;
+      else log_warn("Unknown write watch mode: %s", mode);
+    }
+    else if (!std::strcmp(argv[i], "--write-watch-log") && has_value) {
+      // what was written, frame by frame
+      writewatch::SetFrameLog(argv[++i]);
+    }
+    else {
+      log_warn("Ignoring unknown argument: %s", argv[i]);
+    }
+  }
+
+  // batch runs and benchmarks should not wait for real time, unless asked to
+  if ((options.headless || options.benchmark) && !speed_set) {
+    pacing::SetSpeed(0);
+  }
+  // and there is nobody to ask for a rewind
+  if (options.headless && !rewind_set) {
+    options.rewind_megabytes = 0;
+  }
+  if (options.benchmark && options.replay_file.empty()) {
+    log_fatal("--benchmark needs a movie to --replay");
+  }
+  return options;
+}
+
 int main(int argc, char** argv) {
+  const auto options = ParseArguments(argc, argv);
   log_info("Launching frontend");
-  frontend::InitFrontend();
+  frontend::InitFrontend(options);
   log_info("Calling AgbMain");
   AgbMain();
 }
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "movie.h"
+#include "agb_flash_port.h"
+#include "log.h"
+
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+
+namespace movie {
+
+// movie files hold a header, followed by runs of frames with the same keypad state
+// everything is little endian
+struct Header {
+  static constexpr u32 ExpectedMagic   = 0x564d5250;  // "PRMV"
+  static constexpr u16 CurrentVersion  = 1;
+
+  u32 magic;
+  u16 version;
+  u16 reserved;
+  u64 flash_checksum;  // replays only match if they start from the same save
+  u64 frame_count;
+};
+static_assert(sizeof(Header) == 24);
+
+struct Run {
+  u16 keypad;
+  u16 length;  // number of frames - 1
+};
+static_assert(sizeof(Run) == 4);
+
+enum class Mode {
+  None,
+  Recording,
+  Replaying,
+  Benchmark,
+};
+
+static Mode CurrentMode = Mode::None;
+static std::string Path{};
+static std::vector<Run> Runs{};
+static u64 FrameCount = 0;
+static u64 FlashChecksum = 0;
+
+// replay position
+static size_t RunIndex = 0;
+static u32 RunFrame = 0;
+// frames played from the movie so far, the run may stop before its end
+static u64 ReplayedFrames = 0;
+
+static std::chrono::steady_clock::time_point BenchmarkStart{};
+
+void StartRecording(const std::string& path) {
+  CurrentMode = Mode::Recording;
+  Path        = path;
+  Runs.clear();
+  FrameCount  = 0;
+
+  // the save the game boots from, replays warn if theirs differs
+  FlashChecksum = flash::Checksum();
+  log_info("Recording movie to %s", path.c_str());
+}
+
+void StartReplay(const std::string& path, bool benchmark) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    log_fatal("Failed to open movie file %s", path.c_str());
+  }
+
+  Header header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || header.magic != Header::ExpectedMagic) {
+    log_fatal("%s is not a movie file", path.c_str());
+  }
+  if (header.version != Header::CurrentVersion) {
+    log_fatal("Unsupported movie version %d in %s", header.version, path.c_str());
+  }
+
+  Runs.clear();
+  Run run;
+  while (file.read(reinterpret_cast<char*>(&run), sizeof(run))) {
+    Runs.push_back(run);
+  }
+
+  CurrentMode = benchmark ? Mode::Benchmark : Mode::Replaying;
+  Path        = path;
+  FrameCount  = header.frame_count;
+  RunIndex    = 0;
+  RunFrame    = 0;
+  ReplayedFrames = 0;
+
+  // replays should be repeatable, so they never write the save file
+  flash::SetPersistent(false);
+  if (header.flash_checksum != flash::Checksum()) {
+    log_warn("Save file differs from the one the movie was recorded with, the replay will likely desync");
+  }
+  log_info("Replaying %llu frames from %s", (unsigned long long)FrameCount, path.c_str());
+}
+
+bool Replaying() {
+  return CurrentMode == Mode::Replaying || CurrentMode == Mode::Benchmark;
+}
+
+bool Benchmarking() {
+  return CurrentMode == Mode::Benchmark;
+}
+
+static void Record(u16 keypad) {
+  if (!Runs.empty() && Runs.back().keypad == keypad && Runs.back().length != 0xffff) {
+    Runs.back().length++;
+  }
+  else {
+    Runs.push_back({keypad, 0});
+  }
+  FrameCount++;
+}
+
+bool ProcessFrame(u16& keypad) {
+  switch (CurrentMode) {
+    case Mode::None:
+      return true;
+    case Mode::Recording:
+      Record(keypad);
+      return true;
+    case Mode::Replaying:
+    case Mode::Benchmark:
+      break;
+  }
+
+  if (RunIndex == 0 && RunFrame == 0) {
+    BenchmarkStart = std::chrono::steady_clock::now();
+  }
+
+  if (RunIndex >= Runs.size()) {
+    if (CurrentMode == Mode::Benchmark) return false;
+
+    log_info("Movie ended, back to live input");
+    CurrentMode = Mode::None;
+    return true;
+  }
+
+  keypad = Runs[RunIndex].keypad;
+  ReplayedFrames++;
+  if (RunFrame++ == Runs[RunIndex].length) {
+    RunIndex++;
+    RunFrame = 0;
+  }
+  return true;
+}
+
+void Finish() {
+  switch (CurrentMode) {
+    case Mode::None:
+    case Mode::Replaying:
+      break;
+    case Mode::Recording: {
+      std::ofstream file(Path, std::ios::trunc | std::ios::binary);
+      if (!file.is_open()) {
+        log_fatal("Failed to open movie file %s", Path.c_str());
+      }
+
+      const Header header = {Header::ExpectedMagic, Header::CurrentVersion, 0, FlashChecksum, FrameCount};
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(Runs.data()), Runs.size() * sizeof(Run));
+      log_info("Recorded %llu frames to %s", (unsigned long long)FrameCount, Path.c_str());
+      break;
+    }
+    case Mode::Benchmark: {
+      const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - BenchmarkStart).count();
+      std::printf("Benchmark: %llu frames in %.3f s (%.2f fps)\n", (unsigned long long)ReplayedFrames, seconds, ReplayedFrames / seconds);
+      break;
+    }
+  }
+  CurrentMode = Mode::None;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "helpers.h"
+
+#include <string>
+
+namespace movie {
+
+// record the keypad state of every frame, the file is written by Finish
+void StartRecording(const std::string& path);
+
+// replay the keypad state from a movie file
+// in benchmark mode, the run closes when the movie ends, and reports the frame rate
+void StartReplay(const std::string& path, bool benchmark);
+
+bool Replaying();
+bool Benchmarking();
+
+// called once per frame after polling input
+// records keypad, or overwrites it with the recorded state
+// returns false if a benchmark replay has ended
+bool ProcessFrame(u16& keypad);
+
+// write the recording, and report benchmark results
+void Finish();
+
+}
\ No newline at end of file
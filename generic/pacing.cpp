@@ -0,0 +1,141 @@
+#include "pacing.h"
+#include "log.h"
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SPIN_PAUSE() _mm_pause()
+#else
+#define SPIN_PAUSE()
+#endif
+
+#undef max
+#undef min
+
+
+namespace pacing {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+static const Clock::duration RealTimePeriod = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(1.0 / GbaFrameRate)
+);
+
+// if we are this far behind, give up on catching up (after a stall, or a breakpoint)
+static constexpr u32 ResyncFrames = 8;
+
+static double Speed = 1.0;
+static bool Turbo = false;
+static u32 MaxFrameSkip = 4;
+
+static Clock::duration Period = RealTimePeriod;
+static Clock::time_point Deadline = {};  // when the current frame is due
+static Clock::time_point LastPresented = {};
+static u32 SkippedFrames = 0;
+static bool Started = false;
+
+// time left to spin after sleeping, adjusted to how much sleeping overshoots on this host
+static Clock::duration SpinMargin = 1ms;
+
+void SetSpeed(double speed) {
+  Speed = std::max(speed, 0.0);
+  if (Speed) {
+    Period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / (GbaFrameRate * Speed)));
+    log_info("Running at %.2fx speed", Speed);
+  }
+  else {
+    log_info("Running at unlimited speed");
+  }
+
+  // start counting from the current frame
+  Started = false;
+}
+
+double GetSpeed() {
+  return Speed;
+}
+
+void SetTurbo(bool turbo) {
+  if (turbo == Turbo) return;
+  Turbo   = turbo;
+  Started = false;
+}
+
+bool GetTurbo() {
+  return Turbo;
+}
+
+void SetMaxFrameSkip(u32 max_frame_skip) {
+  MaxFrameSkip = max_frame_skip;
+}
+
+static bool Unlimited() {
+  return Turbo || !Speed;
+}
+
+bool ShouldPresentFrame() {
+  const auto now = Clock::now();
+  if (Unlimited()) {
+    // there is no point in presenting faster than the display can show
+    if (now - LastPresented < RealTimePeriod) return false;
+    LastPresented = now;
+    return true;
+  }
+  if (!Started) return true;
+
+  // the frame is due at the deadline, if we are a whole frame late, skip it
+  if (now > Deadline + Period && SkippedFrames < MaxFrameSkip) {
+    SkippedFrames++;
+    return false;
+  }
+  SkippedFrames = 0;
+  return true;
+}
+
+static void WaitUntil(Clock::time_point time) {
+  // sleeping is not precise, so sleep for most of the time, and spin for the rest
+  const auto start = Clock::now();
+  if (time - start > SpinMargin) {
+    const auto requested = time - start - SpinMargin;
+    std::this_thread::sleep_for(requested);
+    const auto overshoot = Clock::now() - start - requested;
+
+    // grow the margin right away when we overslept, shrink it slowly otherwise
+    if (overshoot > SpinMargin) {
+      SpinMargin = std::min<Clock::duration>(overshoot + 250us, RealTimePeriod / 2);
+    }
+    else {
+      SpinMargin = std::max<Clock::duration>(SpinMargin - SpinMargin / 64, 500us);
+    }
+  }
+
+  while (Clock::now() < time) {
+    SPIN_PAUSE();
+  }
+}
+
+void EndFrame() {
+  if (Unlimited()) return;
+
+  const auto now = Clock::now();
+  if (!Started) {
+    Started       = true;
+    Deadline      = now + Period;
+    SkippedFrames = 0;
+    return;
+  }
+
+  if (now > Deadline + ResyncFrames * Period) {
+    log_debug("Frame pacing fell too far behind, resynchronizing");
+    Deadline = now + Period;
+    return;
+  }
+  WaitUntil(Deadline);
+  Deadline += Period;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "helpers.h"
+
+namespace pacing {
+
+// 16.78 MHz / 280896 cycles per frame
+static constexpr double GbaFrameRate = 59.7275;
+
+// multiplier on the GBA frame rate, 0 runs as fast as possible
+void SetSpeed(double speed);
+double GetSpeed();
+
+// run as fast as possible regardless of the speed, while this is set
+void SetTurbo(bool turbo);
+bool GetTurbo();
+
+// maximum number of consecutive frames that are not presented when falling behind
+void SetMaxFrameSkip(u32 max_frame_skip);
+
+// whether the frame that was just emulated should be rendered and presented
+// false if we are behind schedule, or if we are running faster than frames can be shown
+bool ShouldPresentFrame();
+
+// wait until the next frame is due
+void EndFrame();
+
+}
\ No newline at end of file
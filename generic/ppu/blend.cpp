@@ -0,0 +1,120 @@
+#include "blend.h"
+#include "frontend.h"
+
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BLEND_X86
+#include <immintrin.h>
+#endif
+
+#undef max
+#undef min
+
+
+namespace ppu {
+
+static_assert(frontend::GbaWidth % 16 == 0, "Scanline width must be a multiple of the vector width");
+
+static inline u16 Blend(u16 color_a, u16 color_b, u16 eva, u16 evb) {
+  u16 blend = 0;
+
+  // colors in BGR555 format
+  for (int shift = 0; shift < 15; shift += 5) {
+    // 1.4 fixed point
+    const u16 channel = (u16)((((color_a >> shift) & 0x1f) * eva + ((color_b >> shift) & 0x1f) * evb) >> 4);
+    blend |= (u16)(std::min<u16>(channel, 0x1f) << shift);
+  }
+  return blend;
+}
+
+static void BlendLineScalar(u16* dest, const u16* top, const u16* bottom, const u8* flags, u8 mask, u16 eva, u16 evb) {
+  for (int i = 0; i < frontend::GbaWidth; i++) {
+    const u16 blend = Blend(top[i], bottom[i], eva, evb);
+    dest[i] = (flags[i] & mask) == mask ? blend : top[i];
+  }
+}
+
+#ifdef BLEND_X86
+
+template<int shift>
+__attribute__((target("sse2")))
+static inline __m128i BlendChannelSSE2(__m128i color_a, __m128i color_b, __m128i eva, __m128i evb) {
+  const __m128i channel_mask = _mm_set1_epi16(0x1f);
+  const __m128i a = _mm_and_si128(_mm_srli_epi16(color_a, shift), channel_mask);
+  const __m128i b = _mm_and_si128(_mm_srli_epi16(color_b, shift), channel_mask);
+
+  // at most 2 * 0x1f * 0x10, so this never overflows 16 bits
+  const __m128i channel = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, eva), _mm_mullo_epi16(b, evb)), 4);
+  return _mm_slli_epi16(_mm_min_epi16(channel, channel_mask), shift);
+}
+
+__attribute__((target("sse2")))
+static void BlendLineSSE2(u16* dest, const u16* top, const u16* bottom, const u8* flags, u8 mask, u16 eva, u16 evb) {
+  const __m128i eva_v  = _mm_set1_epi16(eva);
+  const __m128i evb_v  = _mm_set1_epi16(evb);
+  const __m128i mask_v = _mm_set1_epi16(mask);
+
+  for (int i = 0; i < frontend::GbaWidth; i += 8) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)&top[i]);
+    const __m128i b = _mm_loadu_si128((const __m128i*)&bottom[i]);
+    const __m128i f = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&flags[i]), _mm_setzero_si128());
+
+    const __m128i blend = _mm_or_si128(
+        _mm_or_si128(BlendChannelSSE2<0>(a, b, eva_v, evb_v), BlendChannelSSE2<5>(a, b, eva_v, evb_v)),
+        BlendChannelSSE2<10>(a, b, eva_v, evb_v)
+    );
+    const __m128i select = _mm_cmpeq_epi16(_mm_and_si128(f, mask_v), mask_v);
+    _mm_storeu_si128((__m128i*)&dest[i], _mm_or_si128(_mm_and_si128(select, blend), _mm_andnot_si128(select, a)));
+  }
+}
+
+template<int shift>
+__attribute__((target("avx2")))
+static inline __m256i BlendChannelAVX2(__m256i color_a, __m256i color_b, __m256i eva, __m256i evb) {
+  const __m256i channel_mask = _mm256_set1_epi16(0x1f);
+  const __m256i a = _mm256_and_si256(_mm256_srli_epi16(color_a, shift), channel_mask);
+  const __m256i b = _mm256_and_si256(_mm256_srli_epi16(color_b, shift), channel_mask);
+
+  const __m256i channel = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a, eva), _mm256_mullo_epi16(b, evb)), 4);
+  return _mm256_slli_epi16(_mm256_min_epi16(channel, channel_mask), shift);
+}
+
+__attribute__((target("avx2")))
+static void BlendLineAVX2(u16* dest, const u16* top, const u16* bottom, const u8* flags, u8 mask, u16 eva, u16 evb) {
+  const __m256i eva_v  = _mm256_set1_epi16(eva);
+  const __m256i evb_v  = _mm256_set1_epi16(evb);
+  const __m256i mask_v = _mm256_set1_epi16(mask);
+
+  for (int i = 0; i < frontend::GbaWidth; i += 16) {
+    const __m256i a = _mm256_loadu_si256((const __m256i*)&top[i]);
+    const __m256i b = _mm256_loadu_si256((const __m256i*)&bottom[i]);
+    const __m256i f = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)&flags[i]));
+
+    const __m256i blend = _mm256_or_si256(
+        _mm256_or_si256(BlendChannelAVX2<0>(a, b, eva_v, evb_v), BlendChannelAVX2<5>(a, b, eva_v, evb_v)),
+        BlendChannelAVX2<10>(a, b, eva_v, evb_v)
+    );
+    const __m256i select = _mm256_cmpeq_epi16(_mm256_and_si256(f, mask_v), mask_v);
+    _mm256_storeu_si256((__m256i*)&dest[i], _mm256_blendv_epi8(a, blend, select));
+  }
+}
+
+#endif
+
+static BlendLineFn SelectBlendLine() {
+#ifdef BLEND_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return BlendLineAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return BlendLineSSE2;
+  }
+#endif
+  return BlendLineScalar;
+}
+
+const BlendLineFn BlendLine = SelectBlendLine();
+
+}
\ No newline at end of file
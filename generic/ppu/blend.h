@@ -0,0 +1,14 @@
+#pragma once
+
+#include "helpers.h"
+
+namespace ppu {
+
+// dest[x] = Blend(top[x], bottom[x], eva, evb) for every pixel that has all bits of mask set in flags[x],
+// dest[x] = top[x] for all others
+using BlendLineFn = void (*)(u16* dest, const u16* top, const u16* bottom, const u8* flags, u8 mask, u16 eva, u16 evb);
+
+// 16 pixels per step with AVX2, 8 with SSE2, one at a time on other hosts
+extern const BlendLineFn BlendLine;
+
+}
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "log.h"
+#include "frontend.h"
+
+#include <algorithm>
+#include <bitset>
 
 namespace ppu {
 
@@ -18,6 +22,14 @@ struct BGData {
   bool blend_top;
   bool blend_bottom;
 
+  // decoded from bgcnt
+  u32 priority;
+  u32 char_base_block;
+  u32 color_mode;
+  u32 screen_base_block;
+  u32 screen_size;
+  bool wraparound;
+
   struct {
     s32 ref_x;
     s32 ref_y;
@@ -33,153 +45,106 @@ struct ObjSize {
   u32 height;
 };
 
-struct Pixel {
-private:
-  struct {
-    u16 color;
-    bool blend;
-  } layers[2];
-  uint_fast8_t filled;
-
-  static u16 Blend(u16 color_a, u16 color_b, u16 eva, u16 evb) {
-    u16 blend = 0;
-
-    // colors in BGR555 format
-    u16 bgr;
+// scanline buffer, split into planes so that composing can be done on many pixels at once
+// each pixel holds up to 2 layers: the topmost one, and the one below it if the top layer blends
+struct Scanline {
+  enum Flags : u8 {
+    Filled      = 0x01,  // top layer was written
+    TopBlend    = 0x02,  // top layer is a first target for alpha blending
+    BottomBlend = 0x04,  // layer below the top layer (or backdrop) is a second target for alpha blending
+    Done        = 0x08,  // no more layers are needed for this pixel
+    Fade        = 0x10,  // top layer (or backdrop) is a target for brightness fades
+  };
 
-    // Blend red
-    bgr = (u16)(((color_a & 0x001f) * eva + (color_b & 0x001f) * evb) >> 4);                  // 1.4 fixed point
-    blend |= (u16)(bgr >= 0x1f ? 0x001f : (bgr << 0));
+  u16 top[frontend::GbaWidth];
+  u16 bottom[frontend::GbaWidth];
+  u8 flags[frontend::GbaWidth];
 
-    // Blend green
-    bgr = (u16)((((color_a & 0x03e0) >> 5) * eva + ((color_b & 0x03e0) >> 5) * evb) >> 4);    // 1.4 fixed point
-    blend |= (u16)(bgr >= 0x1f ? 0x03e0 : (bgr << 5));
+  // flags added to a blending top layer, for when the backdrop ends up below it
+  u8 backdrop_bottom;
 
-    // Blend blue
-    bgr = (u16)((((color_a & 0x7c00) >> 10) * eva + ((color_b & 0x7c00) >> 10) * evb) >> 4);  // 1.4 fixed point
-    blend |= (u16)(bgr >= 0x1f ? 0x7c00 : (bgr << 10));
-
-    return blend;
+  void Clear(u16 backdrop, bool backdrop_top, bool backdrop_bottom) {
+    std::fill_n(top, frontend::GbaWidth, backdrop);
+    std::fill_n(bottom, frontend::GbaWidth, backdrop);
+    std::fill_n(flags, frontend::GbaWidth, backdrop_top ? Fade : 0);
+    this->backdrop_bottom = backdrop_bottom ? BottomBlend : 0;
   }
 
-public:
-  inline bool IsFilled() {
-    switch(filled) {
-      case 0: return false;
-      case 1: return !layers[0].blend;
-      case 2:
-      default: return true;
-    }
+  inline bool IsDone(int x) const {
+    return (flags[x] & Done) != 0;
   }
 
-  inline void SetColor(u16 color, bool blend_top, bool blend_bottom) {
-    switch(filled) {
-      case 0:
-        layers[0].color = color;
-        layers[0].blend = blend_top;
-        // if layer does not blend, then we are done
-        filled = blend_top ? 1 : 2;
-        break;
-      case 1:
-        if (blend_bottom) {
-          layers[1].color = color;
-        }
-        layers[1].blend = blend_bottom;
-        filled = 2;
-      case 2:
-      default:
-        return;
-    }
-  }
+  inline void SetColor(int x, u16 color, bool blend_top, bool blend_bottom) {
+    const u8 pixel_flags = flags[x];
+    if (pixel_flags & Done) return;
 
-  inline u16 GetColor(BlendMode mode, u16 backdrop, bool backdrop_top, bool backdrop_bottom, u16 eva, u16 evb, u16 evy) {
-    switch (mode) {
-      case BlendMode::Off:
-        return filled > 0 ? layers[0].color : backdrop;
-      case BlendMode::Normal:
-        switch(filled) {
-          case 0: return backdrop;
-          case 1:
-            if (layers[0].blend && backdrop_bottom) {
-              return Blend(layers[0].color, backdrop, eva, evb);
-            }
-            return layers[0].color;
-          case 2:
-            if (layers[0].blend && layers[1].blend) {
-              return Blend(layers[0].color, layers[1].color, eva, evb);
-            }
-            return layers[0].color;
-          default:
-            log_fatal("Invalid filled value");
-        }
-      case BlendMode::White:
-        if (filled > 0) [[likely]] {
-          return Blend(layers[0].color, 0x7fff, 0x10 - evy, evy);
-        }
-        else {
-          if (backdrop_top) {
-            return Blend(backdrop, 0x7fff, 0x10 - evy, evy);
-          }
-          return backdrop;
-        }
-      case BlendMode::Black:
-        if (filled > 0) [[likely]] {
-          return Blend(layers[0].color, 0x0000, 0x10 - evy, evy);
-        }
-        else {
-          if (backdrop_top) {
-            return Blend(backdrop, 0x0000, 0x10 - evy, evy);
-          }
-          return backdrop;
-        }
+    if (!(pixel_flags & Filled)) {
+      top[x]   = color;
+      // if layer does not blend, then we are done
+      flags[x] = Filled | Fade | (blend_top ? (TopBlend | backdrop_bottom) : Done);
+    }
+    else {
+      bottom[x] = color;
+      flags[x]  = (pixel_flags & ~BottomBlend) | Done | (blend_bottom ? BottomBlend : 0);
     }
   }
 };
 
 static BGData GetBGData(u32 bg) {
+  BGData bg_data;
   switch (bg) {
-    case 0: return {
+    case 0: bg_data = {
           REG_BG0HOFS,
           REG_BG0VOFS,
           REG_BG0CNT,
           (REG_BLDCNT & (1 << bg)) != 0,
           (REG_BLDCNT & (0x100 << bg)) != 0,
-          {}  // no affine parameters for layer
       };
-    case 1: return {
+      break;
+    case 1: bg_data = {
           REG_BG1HOFS,
           REG_BG1VOFS,
           REG_BG1CNT,
           (REG_BLDCNT & (1 << bg)) != 0,
           (REG_BLDCNT & (0x100 << bg)) != 0,
-          {}  // no affine parameters for layer
       };
-    case 2: return {
+      break;
+    case 2: bg_data = {
           REG_BG2HOFS,
           REG_BG2VOFS,
           REG_BG2CNT,
           (REG_BLDCNT & (1 << bg)) != 0,
           (REG_BLDCNT & (0x100 << bg)) != 0,
-          {
-              (s32)(REG_BG2X << 4) >> 4,
-              (s32)(REG_BG2Y << 4) >> 4,
-              (s16)REG_BG2PA, (s16)REG_BG2PB, (s16)REG_BG2PC, (s16)REG_BG2PD
-          }
       };
-    case 3: return {
+      bg_data.rot_scale = {
+          (s32)(REG_BG2X << 4) >> 4,
+          (s32)(REG_BG2Y << 4) >> 4,
+          (s16)REG_BG2PA, (s16)REG_BG2PB, (s16)REG_BG2PC, (s16)REG_BG2PD
+      };
+      break;
+    case 3: bg_data = {
           REG_BG3HOFS,
           REG_BG3VOFS,
           REG_BG3CNT,
           (REG_BLDCNT & (1 << bg)) != 0,
           (REG_BLDCNT & (0x100 << bg)) != 0,
-          {
-              (s32)(REG_BG2X << 4) >> 4,
-              (s32)(REG_BG2Y << 4) >> 4,
-              (s16)REG_BG3PA, (s16)REG_BG3PB, (s16)REG_BG3PC, (s16)REG_BG3PD
-          }
       };
+      bg_data.rot_scale = {
+          (s32)(REG_BG2X << 4) >> 4,
+          (s32)(REG_BG2Y << 4) >> 4,
+          (s16)REG_BG3PA, (s16)REG_BG3PB, (s16)REG_BG3PC, (s16)REG_BG3PD
+      };
+      break;
     default: log_fatal("Invalid background: %d", bg);
   }
+
+  bg_data.priority          = bg_data.bgcnt & 3;
+  bg_data.char_base_block   = (bg_data.bgcnt >> 2) & 3;
+  bg_data.color_mode        = (bg_data.bgcnt >> 7) & 1;
+  bg_data.screen_base_block = (bg_data.bgcnt >> 8) & 0x1f;
+  bg_data.screen_size       = (bg_data.bgcnt >> 14) & 3;
+  bg_data.wraparound        = ((bg_data.bgcnt >> 13) & 1) != 0;
+  return bg_data;
 }
 
 static u32 VramIndexRegular(u32 tile_x, u32 tile_y, u32 screen_block_size) {
@@ -204,6 +169,94 @@ static constexpr ObjSize ObjSizeTable[3][4] = {
     { {8, 16}, {8, 32},  {16, 32}, {32, 64} }
 };
 
-void RenderScanline(u32 scanline, color_t* dest);
+// memory the renderer reads from
+// this is either the live memory, or a copy taken at VBlank for pipelined rendering
+struct VideoMemory {
+  const u8* vram;
+  const u8* pltt;
+  const u8* oam;
+};
+
+// register state the scanline renderer depends on
+// if this does not change over a frame, it only has to be computed once
+struct PPUState {
+  VideoMemory mem;
+
+  u16 dispcnt;
+  u32 mode;
+  bool obj_1d_mapping;
+
+  BGData bg[4];
+  bool affine[4];
+
+  // enabled backgrounds, ordered by priority
+  u32 layer_count;
+  u32 layers[4];
 
+  BlendMode blend_mode;
+  bool backdrop_top;
+  bool backdrop_bottom;
+  u16 eva;
+  u16 evb;
+  u16 evy;
+};
+
+// OAM indices of the objects visible on each scanline,
+// sorted by priority, then by OAM index
+struct ObjectBins {
+  u8 count[frontend::GbaHeight];
+  u8 index[frontend::GbaHeight][128];
+};
+
+// VRAM with every 4bpp pixel expanded to its own byte, so VRAM address a maps to 2 * a
+extern u8 ExpandedVram[2 * sizeof(mem_vram)];
+
+using DirtyTiles = std::bitset<sizeof(mem_vram) / 0x20>;
+
+// tiles reported through MarkVramDirty since the last call
+DirtyTiles TakeDirtyTiles();
+
+// re-expand the tiles that are marked dirty, or that differ from when they were last expanded
+void RefreshTileCache(const u8* vram, const DirtyTiles& dirty);
+
+// re-expand only the tiles that are marked dirty, for writes in the middle of a frame
+void RefreshMarkedTiles(const u8* vram, const DirtyTiles& dirty);
+
+// the registers a PPUState is decoded from, at the start of the I/O registers
+static constexpr u32 StateRegistersSize = REG_OFFSET_BLDY + sizeof(u16);
+
+// parts of a PPUState, by the registers they are decoded from
+using StateChanges = u32;
+static constexpr StateChanges DisplayControlChange = 0x01;  // DISPCNT
+static constexpr StateChanges LayerChange          = 0x02;  // DISPCNT, BGxCNT: the enabled layers and their order
+static constexpr StateChanges BlendChange          = 0x04;  // BLDCNT, BLDALPHA, BLDY
+static constexpr StateChanges AllBGsChange         = 0xf0;  // the BGData of every background
+static constexpr StateChanges AllChanges           = 0xff;
+
+static constexpr StateChanges BGChange(u32 bg) {
+  return 0x10 << bg;
 }
+
+// the parts of the state that depend on the 16 bit register at offset
+StateChanges StateChangesFrom(u32 offset);
+
+// decode the given parts of the state from the registers again, leaving the rest as it is
+void UpdatePPUState(PPUState& state, StateChanges changes);
+PPUState GetPPUState();
+const ObjectBins& GetObjectBins(const PPUState& state);
+void RenderScanline(const PPUState& state, const ObjectBins& objects, u32 scanline, color_t* dest);
+
+// render all scanlines from the same state, only valid for frames without raster effects
+void RenderFrame(const PPUState& state, color_t* screen);
+// render every scanline from its own state, objects are binned from the first one
+void RenderFrame(const PPUState* line_states, color_t* screen);
+
+// registers change during the frame in ways that need the live state while rendering
+bool HasRasterEffects();
+
+// go through the visible scanlines, running what happens at every HBlank
+// stores the register state every scanline starts with into line_states
+// returns whether the state changed during the frame
+bool RunScanlines(PPUState* line_states);
+
+}
\ No newline at end of file
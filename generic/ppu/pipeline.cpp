@@ -0,0 +1,124 @@
+#include "pipeline.h"
+#include "workers.h"
+
+#include <cstring>
+
+
+namespace ppu {
+
+RenderThread::RenderThread() {
+  // make sure the band renderer outlives this thread, statics are destroyed in reverse order
+  GetBandRenderer();
+  thread = std::thread(&RenderThread::Run, this);
+}
+
+RenderThread::~RenderThread() {
+  {
+    std::lock_guard lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  thread.join();
+}
+
+void RenderThread::Submit() {
+  int slot;
+  {
+    std::unique_lock lock(mutex);
+    idle.wait(lock, [&]{ return queued == None; });
+    slot = rendering == 0 ? 1 : 0;
+  }
+
+  // the render thread never touches a slot that is not queued or being rendered
+  FrameSnapshot& snapshot = snapshots[slot];
+  snapshot.per_line = RunScanlines(snapshot.line_states.data());
+  if (snapshot.per_line) {
+    for (auto& state : snapshot.line_states) {
+      state.mem = {snapshot.vram, snapshot.pltt, snapshot.oam};
+    }
+  }
+  snapshot.state = snapshot.line_states[0];
+  snapshot.dirty = TakeDirtyTiles();
+  std::memcpy(snapshot.vram, mem_vram, sizeof(snapshot.vram));
+  std::memcpy(snapshot.pltt, mem_pltt, sizeof(snapshot.pltt));
+  std::memcpy(snapshot.oam, mem_oam, sizeof(snapshot.oam));
+  snapshot.state.mem = {snapshot.vram, snapshot.pltt, snapshot.oam};
+
+  {
+    std::lock_guard lock(mutex);
+    queued = slot;
+  }
+  wake.notify_one();
+}
+
+void RenderThread::Finish() {
+  std::unique_lock lock(mutex);
+  idle.wait(lock, [&]{ return queued == None && rendering == None; });
+}
+
+color_t* RenderThread::Present() {
+  std::lock_guard lock(mutex);
+  if (fresh) {
+    std::swap(ready, front);
+    fresh = false;
+  }
+  return screens[front].data();
+}
+
+color_t* RenderThread::RenderNow() {
+  Finish();
+
+  // anything the render thread finished is older than this frame
+  {
+    std::lock_guard lock(mutex);
+    fresh = false;
+  }
+  RenderFrame(screens[front].data());
+  return screens[front].data();
+}
+
+void RenderThread::Run() {
+  while (true) {
+    int slot;
+    {
+      std::unique_lock lock(mutex);
+      wake.wait(lock, [&]{ return quit || queued != None; });
+      if (quit) return;
+      slot      = queued;
+      rendering = queued;
+      queued    = None;
+    }
+    idle.notify_all();
+
+    const FrameSnapshot& snapshot = snapshots[slot];
+    RefreshTileCache(snapshot.vram, snapshot.dirty);
+    if (snapshot.per_line) {
+      RenderFrame(snapshot.line_states.data(), screens[back].data());
+    }
+    else {
+      RenderFrame(snapshot.state, screens[back].data());
+    }
+
+    {
+      std::lock_guard lock(mutex);
+      std::swap(back, ready);
+      fresh     = true;
+      rendering = None;
+    }
+    idle.notify_all();
+  }
+}
+
+const color_t* RenderFramePipelined() {
+  static RenderThread render_thread{};
+
+  if (HasRasterEffects()) {
+    // registers change during the frame, so we cannot render from a snapshot taken at VBlank
+    return render_thread.RenderNow();
+  }
+
+  render_thread.Submit();
+  return render_thread.Present();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ppu.h"
+#include "internal.h"
+
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ppu {
+
+// video state at VBlank, everything the renderer needs for a frame without raster effects
+struct FrameSnapshot {
+  PPUState state;
+  // with HBlank DMA, every scanline has its own state
+  bool per_line;
+  std::array<PPUState, frontend::GbaHeight> line_states;
+  DirtyTiles dirty;
+  u8 vram[sizeof(mem_vram)];
+  u8 pltt[sizeof(mem_pltt)];
+  u8 oam[sizeof(mem_oam)];
+};
+
+// renders snapshots on a separate thread
+// snapshots are double buffered (one being rendered, one being filled or queued),
+// finished frames are triple buffered (one being rendered to, one ready, one being presented)
+struct RenderThread {
+  RenderThread();
+  ~RenderThread();
+
+  // copy the current video state and queue it for rendering
+  // blocks if the previous snapshot has not been picked up yet
+  void Submit();
+
+  // wait until every submitted snapshot has been rendered
+  void Finish();
+
+  // the most recent finished frame, this buffer stays valid until the next call
+  color_t* Present();
+
+  // render the current frame on the calling thread instead, into the presented buffer
+  // used for frames with raster effects, since those need the live registers
+  color_t* RenderNow();
+
+private:
+  static constexpr int None = -1;
+
+  void Run();
+
+  std::array<FrameSnapshot, 2> snapshots{};
+  int queued    = None;
+  int rendering = None;
+
+  std::array<std::array<color_t, frontend::GbaWidth * frontend::GbaHeight>, 3> screens{};
+  int back  = 0;
+  int ready = 1;
+  int front = 2;
+  bool fresh = false;
+
+  std::mutex mutex{};
+  std::condition_variable wake{};
+  std::condition_variable idle{};
+  bool quit = false;
+
+  std::thread thread;
+};
+
+}
\ No newline at end of file
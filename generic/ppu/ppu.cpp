@@ -1,25 +1,193 @@
 #include "ppu.h"
 #include "internal.h"
+#include "workers.h"
 #include "frontend.h"
+#include "dma.h"
 #include "helpers.libgba.h"
 
+#include <array>
+#include <cstring>
 
-namespace ppu {
 
+namespace ppu {
 
-void RenderFrame(color_t* screen) {
+bool HasRasterEffects() {
   bool hblank_activity = nongeneric::HasHBlankCallback() && (REG_DISPSTAT & DISPSTAT_HBLANK_INTR) && (REG_IE & INTR_FLAG_HBLANK);
   bool vcount_activity = nongeneric::HasVCountCallback() && (REG_DISPSTAT & DISPSTAT_VCOUNT_INTR) && (REG_IE & INTR_FLAG_VCOUNT);
-  bool hblank_dma      = false;
+  // HBlank DMA into registers is fine, RunScanlines can get the state of every scanline up front
+  bool hblank_dma      = dma::HasHBlankTransfers() && dma::HBlankTransfersWriteMemory();
+
+  return hblank_activity || vcount_activity || hblank_dma;
+}
+
+// lines after the visible ones are in VBlank
+static constexpr u32 ScanlineCount = 228;
+
+static bool Scheduling = false;
+
+u16 ReadVCount() {
+  u16& vcount = *(u16*)&TrappedIORegisters[REG_OFFSET_VCOUNT];
+  if (!Scheduling) vcount = (vcount + 1) % ScanlineCount;
+  return vcount;
+}
+
+static void StartScanline(u32 line) {
+  *(u16*)&TrappedIORegisters[REG_OFFSET_VCOUNT] = line;
+
+  u16 dispstat = REG_DISPSTAT & ~(DISPSTAT_VBLANK | DISPSTAT_HBLANK | DISPSTAT_VCOUNT);
+  // the VBlank flag is already cleared on the last line
+  if (line >= frontend::GbaHeight && line < ScanlineCount - 1) dispstat |= DISPSTAT_VBLANK;
+  const bool vcount_match = (dispstat >> 8) == line;
+  if (vcount_match) dispstat |= DISPSTAT_VCOUNT;
+  REG_DISPSTAT = dispstat;
+
+  if (vcount_match && (dispstat & DISPSTAT_VCOUNT_INTR)) {
+    nongeneric::HandleInterrupt(Interrupt::VCountMatch);
+  }
+}
+
+static void EnterHBlank(u32 line) {
+  REG_DISPSTAT = REG_DISPSTAT | DISPSTAT_HBLANK;
+  // HBlank DMA only happens on visible scanlines, the interrupt happens on all of them
+  if (line < frontend::GbaHeight) dma::OnHBlank();
+  if (REG_DISPSTAT & DISPSTAT_HBLANK_INTR) {
+    nongeneric::HandleInterrupt(Interrupt::HBlank);
+  }
+}
+
+// go through the visible scanlines, draw(line) is called at the start of every line,
+// after the VCount match interrupt and before HBlank
+template<typename F>
+static void RunVisibleScanlines(F&& draw) {
+  Scheduling = true;
+  for (u32 line = 0; line < frontend::GbaHeight; line++) {
+    StartScanline(line);
+    draw(line);
+    EnterHBlank(line);
+  }
+  Scheduling = false;
+}
+
+void StartVBlank() {
+  Scheduling = true;
+  StartScanline(frontend::GbaHeight);
+}
+
+void FinishVBlank() {
+  EnterHBlank(frontend::GbaHeight);
+  for (u32 line = frontend::GbaHeight + 1; line < ScanlineCount; line++) {
+    StartScanline(line);
+    EnterHBlank(line);
+  }
+  Scheduling = false;
+}
+
+// DISPSTAT and VCOUNT change every scanline, but the state does not depend on them
+static constexpr u32 StateRegistersStart[2] = {REG_OFFSET_DISPCNT, REG_OFFSET_BG0CNT};
+static constexpr u32 StateRegistersEnd[2]   = {REG_OFFSET_DISPSTAT, StateRegistersSize};
+
+// the register state, only the parts that depend on registers that changed are decoded again
+class StateCache {
+ public:
+  const PPUState& Get() {
+    if (!valid) {
+      std::memcpy(registers, IORegisters, sizeof(registers));
+      state = GetPPUState();
+      valid = true;
+      generation++;
+      return state;
+    }
+
+    StateChanges changes = 0;
+    for (int i = 0; i < 2; i++) {
+      const u32 start = StateRegistersStart[i], end = StateRegistersEnd[i];
+      if (std::memcmp(&registers[start], &IORegisters[start], end - start) == 0) continue;
+
+      for (u32 offset = start; offset < end; offset += sizeof(u16)) {
+        if (*(const u16*)&registers[offset] != *(const u16*)&IORegisters[offset]) {
+          changes |= StateChangesFrom(offset);
+        }
+      }
+      std::memcpy(&registers[start], &IORegisters[start], end - start);
+    }
+
+    if (changes) {
+      UpdatePPUState(state, changes);
+      generation++;
+    }
+    return state;
+  }
+
+  // changes every time the state is decoded again
+  u32 Generation() const {
+    return generation;
+  }
+
+ private:
+  bool valid = false;
+  u32 generation = 0;
+  u8 registers[StateRegistersSize]{};
+  PPUState state;
+};
+
+static StateCache& GetStateCache() {
+  static StateCache cache{};
+  return cache;
+}
 
-  if (hblank_activity || vcount_activity || hblank_dma) {
+bool RunScanlines(PPUState* line_states) {
+  StateCache& cache = GetStateCache();
+  u32 first_generation = 0;
+  RunVisibleScanlines([&](u32 line) {
+    line_states[line] = cache.Get();
+    if (line == 0) first_generation = cache.Generation();
+  });
+  return cache.Generation() != first_generation;
+}
+
+void SkipFrame() {
+  RunVisibleScanlines([](u32) {});
+}
+
+void RenderFrame(const PPUState& state, color_t* screen) {
+  // scanlines are independent, so they can be rendered in parallel
+  const auto& objects = GetObjectBins(state);
+  GetBandRenderer().Render(state, objects, screen);
+}
+
+void RenderFrame(const PPUState* line_states, color_t* screen) {
+  const auto& objects = GetObjectBins(line_states[0]);
+  GetBandRenderer().Render(line_states, objects, screen);
+}
+
+void RenderFrame(color_t* screen) {
+  RefreshTileCache(mem_vram, TakeDirtyTiles());
+
+  if (HasRasterEffects()) {
     log_debug("No one-shot rendering possible");
+
+    // callbacks and DMA may write anything, so every scanline is rendered from the live state right away
+    // VRAM written by DMA (or caught by the write watch) during the last line is expanded again before the next one,
+    // plain pointer writes from a callback are only seen with the write watch on
+    StateCache& cache = GetStateCache();
+    RunVisibleScanlines([&](u32 line) {
+      if (line != 0) RefreshMarkedTiles(mem_vram, TakeDirtyTiles());
+      const PPUState& state = cache.Get();
+      const auto& objects = GetObjectBins(state);
+      RenderScanline(state, objects, line, screen + line * frontend::GbaWidth);
+    });
+    return;
   }
 
-  // todo: check if gMain.HBlankCallback is set for one shot rendering
-  //       or if any DMA starts at HBlank
-  for (int i = 0; i < frontend::GbaHeight; i++) {
-    RenderScanline(i, screen + i * frontend::GbaWidth);
+  // registers only change through DMA, so the state of every scanline is known before rendering
+  static std::array<PPUState, frontend::GbaHeight> line_states{};
+  if (RunScanlines(line_states.data())) {
+    RenderFrame(line_states.data(), screen);
+  }
+  else {
+    // no register changes within the frame, so decode the register state and
+    // bin the objects once, and render all scanlines from that
+    RenderFrame(line_states[0], screen);
   }
 }
 
@@ -9,4 +9,25 @@ using color_t = u16;
 
 void RenderFrame(u16* screen);
 
+// render frames without raster effects on a separate thread, from a copy of video memory taken now,
+// so that the game can run the next frame in the meantime
+// returns the most recent finished frame, which is usually the one submitted on the previous call
+const u16* RenderFramePipelined();
+
+// for frames that are not rendered, so that what happens every scanline still happens
+void SkipFrame();
+
+// VBlank starts with line 160, around the VBlank interrupt,
+// FinishVBlank runs the remaining lines up to the next frame
+void StartVBlank();
+void FinishVBlank();
+
+// the line the PPU is on, while the scanlines are run
+// outside of that the game is not in sync with the PPU, so every call moves on to the next line,
+// in case the game waits for some line
+u16 ReadVCount();
+
+// invalidate cached tiles in [dest, dest + size), if that range overlaps VRAM
+void MarkVramDirty(const void* dest, u32 size);
+
 }
\ No newline at end of file
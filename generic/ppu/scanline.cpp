@@ -1,13 +1,14 @@
 #include "scanline.h"
 #include "ppu.h"
 #include "internal.h"
+#include "sliver.h"
+#include "blend.h"
 #include "frontend.h"
 
 #include <memory>
 #include <array>
 #include <algorithm>
-#include <vector>
-#include <iterator>
+#include <cstring>
 
 #undef max
 #undef min
@@ -15,55 +16,29 @@
 
 namespace ppu {
 
-static inline void Render4bpp(Pixel* dest, bool blend_top, bool blend_bottom, int start_x, const int x_sign, u8* tile_line_base, u8* palette_base) {
-  const int clamped_start = std::clamp(start_x, 0, frontend::GbaWidth);
-  const int clamped_end = std::clamp(start_x + 8 * x_sign, 0, frontend::GbaWidth);
-  const int dx_min  = x_sign * (clamped_start - start_x);
-  const int dx_max  = x_sign * (clamped_end   - start_x);
+static inline void RenderSliver(Scanline& dest, bool blend_top, bool blend_bottom, int left_x, const Sliver& sliver) {
+  if (!sliver.opaque) return;
 
-  for (int dx = dx_min, screen_x = clamped_start; dx < dx_max; dx++, screen_x += x_sign) {
-    if (dest[screen_x].IsFilled()) continue;
-
-    u8 vram_entry = tile_line_base[dx >> 1];
-    u8 palette_nibble = (dx & 1) ? (vram_entry >> 4) : (vram_entry & 0xf);
+  const int dx_min = std::max(-left_x, 0);
+  const int dx_max = std::min(frontend::GbaWidth - left_x, 8);
 
+  for (int dx = dx_min; dx < dx_max; dx++) {
+    if (!(sliver.opaque & (1 << dx))) continue;
     // todo: check window
-    if (palette_nibble) {
-      dest[screen_x].SetColor(((vu16*)palette_base)[palette_nibble], blend_top, blend_bottom);
-    }
+    dest.SetColor(left_x + dx, sliver.color[dx], blend_top, blend_bottom);
   }
 }
 
-static inline void Render8bpp(Pixel* dest, bool blend_top, bool blend_bottom, int start_x, const int x_sign, u8* tile_line_base, u8* palette_base) {
-  const int clamped_start = std::clamp(start_x, 0, frontend::GbaWidth);
-  const int clamped_end = std::clamp(start_x + 8 * x_sign, 0, frontend::GbaWidth);
-  const int dx_min  = x_sign * (clamped_start - start_x);
-  const int dx_max  = x_sign * (clamped_end   - start_x);
-
-  for (int dx = dx_min, screen_x = clamped_start; dx < dx_max; dx++, screen_x += x_sign) {
-    if (dest[screen_x].IsFilled()) continue;
-
-    u8 vram_entry = tile_line_base[dx];
+// tile_line_base holds one palette index per byte, so 4bpp tiles have to come from ExpandedVram
+static inline void RenderTileLine(Scanline& dest, bool blend_top, bool blend_bottom, int left_x, bool hflip, const u8* tile_line_base, const u8* palette_base) {
+  if (left_x <= -8 || left_x >= frontend::GbaWidth) return;
 
-    // todo: check window
-    if (vram_entry) {
-      dest[screen_x].SetColor(((vu16*)palette_base)[vram_entry], blend_top, blend_bottom);
-    }
-  }
+  Sliver sliver;
+  DecodeSliver(sliver, tile_line_base, (const u16*)palette_base, hflip);
+  RenderSliver(dest, blend_top, blend_bottom, left_x, sliver);
 }
 
-static inline void RenderRegularScanline(u32 bg, u32 scanline, Pixel* dest) {
-  if (!(REG_DISPCNT & (0x0100 << bg))) {
-    // disabled in dispcnt
-    return;
-  }
-
-  const auto bg_data = GetBGData(bg);
-  u32 char_base_block   = (bg_data.bgcnt >> 2) & 3;
-  u32 color_mode        = (bg_data.bgcnt >> 7) & 1;
-  u32 screen_base_block = (bg_data.bgcnt >> 8) & 0x1f;
-  u32 screen_size       = (bg_data.bgcnt >> 14) & 3;
-
+static inline void RenderRegularScanline(const VideoMemory& mem, const BGData& bg_data, u32 scanline, Scanline& dest) {
   u32 effective_y = scanline + bg_data.vofs;
   // todo: mosaic
 
@@ -71,9 +46,9 @@ static inline void RenderRegularScanline(u32 bg, u32 scanline, Pixel* dest) {
     u32 effective_x = (course_x << 3) + bg_data.hofs;
     // todo: mosaic
 
-    u32 screen_entry_index = VramIndexRegular(effective_x >> 3, effective_y >> 3, screen_size);
-    screen_entry_index += screen_base_block * 0x800;
-    u32 screen_entry = (((u16)mem_vram[screen_entry_index + 1]) << 8) | mem_vram[screen_entry_index];
+    u32 screen_entry_index = VramIndexRegular(effective_x >> 3, effective_y >> 3, bg_data.screen_size);
+    screen_entry_index += bg_data.screen_base_block * 0x800;
+    u32 screen_entry = (((u16)mem.vram[screen_entry_index + 1]) << 8) | mem.vram[screen_entry_index];
 
     // get data for screen entry
     u32 palette_bank = (screen_entry >> 12) & 0xf;
@@ -83,29 +58,23 @@ static inline void RenderRegularScanline(u32 bg, u32 scanline, Pixel* dest) {
 
     u32 dy      = effective_y & 7;
     int start_x = (course_x << 3) - (bg_data.hofs & 7);
-    u32 address = char_base_block * 0x4000;
+    u32 address = bg_data.char_base_block * 0x4000;
 
     if (vflip) dy ^= 7;
 
-    int x_sign = 1;
-    if (hflip) {
-      start_x += 7;
-      x_sign = -1;
-    }
-
-    if (!color_mode) {
+    if (!bg_data.color_mode) {
       // 4bpp
       address += tile_id * 0x20;  // beginning of tile
       address += dy * 4;          // beginning of tile sliver
 
-      Render4bpp(
+      RenderTileLine(
           dest,
           bg_data.blend_top,
           bg_data.blend_bottom,
           start_x,
-          x_sign,
-          &mem_vram[address],
-          &mem_pltt[palette_bank * 0x20]
+          hflip,
+          &ExpandedVram[2 * address],
+          &mem.pltt[palette_bank * 0x20]
       );
     }
     else {
@@ -113,49 +82,36 @@ static inline void RenderRegularScanline(u32 bg, u32 scanline, Pixel* dest) {
       address += tile_id * 0x40;  // beginning of tile
       address += dy * 8;          // beginning of tile sliver
 
-      Render8bpp(
+      RenderTileLine(
           dest,
           bg_data.blend_top,
           bg_data.blend_bottom,
           start_x,
-          x_sign,
-          &mem_vram[address],
-          mem_pltt
+          hflip,
+          &mem.vram[address],
+          mem.pltt
       );
     }
   }
 }
 
-static inline void SetAffinePixel(Pixel& pixel, const BGData& bg_data, u8 tile_id, u32 cbb, u8 dx, u8 dy) {
+static inline void SetAffinePixel(const VideoMemory& mem, Scanline& dest, int x, const BGData& bg_data, u8 tile_id, u32 cbb, u8 dx, u8 dy) {
   u32 address = (cbb * 0x4000) | (tile_id * 0x40) | (dy * 8) | dx;
-  u8 vram_entry = mem_vram[address];
+  u8 vram_entry = mem.vram[address];
 
   if (vram_entry) {
-    pixel.SetColor(((vu16*)mem_pltt)[vram_entry], bg_data.blend_top, bg_data.blend_bottom);
+    dest.SetColor(x, ((const u16*)mem.pltt)[vram_entry], bg_data.blend_top, bg_data.blend_bottom);
   }
 }
 
-static inline void RenderAffineScanline(u32 bg, u32 scanline, Pixel* dest) {
+static inline void RenderAffineScanline(const VideoMemory& mem, BGData bg_data, u32 scanline, Scanline& dest) {
   static constexpr u16 AffineSizeTable[] = { 128, 256, 512, 1024 };
 
-  if (!(REG_DISPCNT & (0x0100 << bg))) {
-    // disabled in dispcnt
-    return;
-  }
-
-  auto bg_data = GetBGData(bg);
-
   // update reference point (happens every scanline)
   bg_data.rot_scale.ref_x += scanline * bg_data.rot_scale.pb;
   bg_data.rot_scale.ref_y += scanline * bg_data.rot_scale.pd;
 
-  u32 char_base_block   = (bg_data.bgcnt >> 2) & 3;
-  u32 color_mode        = (bg_data.bgcnt >> 7) & 1;
-  u32 screen_base_block = (bg_data.bgcnt >> 8) & 0x1f;
-  u32 screen_size       = (bg_data.bgcnt >> 14) & 3;
-  bool wraparound       = ((bg_data.bgcnt >> 13) & 1) != 0;
-
-  u32 bg_size           = AffineSizeTable[screen_size];
+  u32 bg_size = AffineSizeTable[bg_data.screen_size];
 
   for (int i = 0; i < frontend::GbaWidth; i++) {
     s32 screen_entry_x = (bg_data.rot_scale.ref_x + bg_data.rot_scale.pa * i) >> 8;  // fractional part
@@ -163,7 +119,7 @@ static inline void RenderAffineScanline(u32 bg, u32 scanline, Pixel* dest) {
 
     if ((std::clamp<s32>(screen_entry_x, 0, bg_size) != screen_entry_x) ||
         (std::clamp<s32>(screen_entry_y, 0, bg_size) != screen_entry_y)) {
-      if (wraparound) {
+      if (bg_data.wraparound) {
         screen_entry_x &= bg_size - 1;
         screen_entry_y &= bg_size - 1;
       }
@@ -172,15 +128,15 @@ static inline void RenderAffineScanline(u32 bg, u32 scanline, Pixel* dest) {
       }
     }
 
-    u32 screen_entry_index = (screen_base_block * 0x800) | ((screen_entry_y >> 3) * (bg_size >> 3)) | (screen_entry_x >> 3);
-    u8 screen_entry = mem_vram[screen_entry_index];
+    u32 screen_entry_index = (bg_data.screen_base_block * 0x800) | ((screen_entry_y >> 3) * (bg_size >> 3)) | (screen_entry_x >> 3);
+    u8 screen_entry = mem.vram[screen_entry_index];
 
-    SetAffinePixel(dest[i], bg_data, screen_entry, char_base_block, screen_entry_x & 7, screen_entry_y & 7);
+    SetAffinePixel(mem, dest, i, bg_data, screen_entry, bg_data.char_base_block, screen_entry_x & 7, screen_entry_y & 7);
   }
 }
 
 static_assert(sizeof(struct OamData) == 8, "Incorrect OamData size for use");
-static inline void RenderRegularObject(const struct OamData& obj, u32 scanline, Pixel* dest, bool obj_1d_mapping) {
+static inline void RenderRegularObject(const VideoMemory& mem, const struct OamData& obj, u32 scanline, Scanline& dest, bool obj_1d_mapping) {
   s32 start_x = (s32)(obj.x << 23) >> 23;
   auto size = ObjSizeTable[obj.shape][obj.size];
   s16 obj_y = obj.y;
@@ -191,12 +147,7 @@ static inline void RenderRegularObject(const struct OamData& obj, u32 scanline,
     dy = size.height - dy - 1;
   }
 
-  s32 x_sign = 1;
-  if (obj.matrixNum & (1 << 3)) {
-    // hflip
-    x_sign = -1;
-    start_x += size.width - 1;
-  }
+  const bool hflip = (obj.matrixNum & (1 << 3)) != 0;
 
   // offset of tile
   u32 sliver_base_address = obj.tileNum * 0x20;
@@ -210,33 +161,37 @@ static inline void RenderRegularObject(const struct OamData& obj, u32 scanline,
 
   if (obj.bpp) {
     for (int tile_x = 0; tile_x < size.width >> 3; tile_x++) {
-      Render8bpp(
+      // tiles are drawn right to left when flipped
+      const int screen_tile_x = hflip ? (size.width >> 3) - 1 - tile_x : tile_x;
+      RenderTileLine(
           dest,
           false,  // todo
           false,  // todo
-          start_x + 8 * tile_x * x_sign,
-          x_sign,
-          &mem_vram[sliver_base_address + 0x40 * tile_x],
-          &mem_pltt[0x200]
+          start_x + 8 * screen_tile_x,
+          hflip,
+          &mem.vram[sliver_base_address + 0x40 * tile_x],
+          &mem.pltt[0x200]
       );
     }
   }
   else {
     for (int tile_x = 0; tile_x < size.width >> 3; tile_x++) {
-      Render4bpp(
+      // tiles are drawn right to left when flipped
+      const int screen_tile_x = hflip ? (size.width >> 3) - 1 - tile_x : tile_x;
+      RenderTileLine(
           dest,
           false,  // todo
           false,  // todo
-          start_x + 8 * tile_x * x_sign,
-          x_sign,
-          &mem_vram[sliver_base_address + 0x20 * tile_x],
-          &mem_pltt[0x200 + 0x20 * obj.paletteNum]
+          start_x + 8 * screen_tile_x,
+          hflip,
+          &ExpandedVram[2 * (sliver_base_address + 0x20 * tile_x)],
+          &mem.pltt[0x200 + 0x20 * obj.paletteNum]
       );
     }
   }
 }
 
-static inline void SetAffineObjPixel(const struct OamData& obj, Pixel* dest, const ObjSize& size, u32 px, u32 py, bool obj_1d_mapping) {
+static inline void SetAffineObjPixel(const VideoMemory& mem, const struct OamData& obj, Scanline& dest, int x, const ObjSize& size, u32 px, u32 py, bool obj_1d_mapping) {
   // start of object vram
   u32 pixel_address = 0x10000;
   pixel_address += obj.tileNum * 0x20;
@@ -247,10 +202,10 @@ static inline void SetAffineObjPixel(const struct OamData& obj, Pixel* dest, con
     pixel_address += 8 * (py & 7);
     pixel_address += 0x40 * (px >> 3);
 
-    u8 vram_entry = mem_vram[pixel_address + (px & 7)];
+    u8 vram_entry = mem.vram[pixel_address + (px & 7)];
     if (vram_entry) {
       // todo: blend mode
-      dest->SetColor(((vu16*)mem_pltt)[0x100 + vram_entry], false, false);
+      dest.SetColor(x, ((const u16*)mem.pltt)[0x100 + vram_entry], false, false);
     }
   }
   else {
@@ -258,30 +213,26 @@ static inline void SetAffineObjPixel(const struct OamData& obj, Pixel* dest, con
     pixel_address += 4 * (py & 7);
     pixel_address += 0x20 * (px >> 3);
 
-    u8 palette_nibble = mem_vram[pixel_address + ((px & 7) >> 1)];
-    if (px & 1) {
-      palette_nibble >>= 4;
-    }
-    palette_nibble &= 0xf;
+    u8 palette_nibble = ExpandedVram[2 * pixel_address + (px & 7)];
 
     if (palette_nibble) {
       // todo: blend mode
-      dest->SetColor(((vu16*)mem_pltt)[0x100 + obj.paletteNum * 0x10 + palette_nibble], false, false);
+      dest.SetColor(x, ((const u16*)mem.pltt)[0x100 + obj.paletteNum * 0x10 + palette_nibble], false, false);
     }
   }
 }
 
-static inline void RenderAffineObject(const struct OamData& obj, u32 scanline, Pixel* dest, bool obj_1d_mapping) {
+static inline void RenderAffineObject(const VideoMemory& mem, const struct OamData& obj, u32 scanline, Scanline& dest, bool obj_1d_mapping) {
   s32 start_x = (s32)(obj.x << 23) >> 23;
   s16 obj_y = obj.y;
   if (obj_y > frontend::GbaHeight) obj_y -= 0x100;
 
   auto size = ObjSizeTable[obj.shape][obj.size];
   s16 pa, pb, pc, pd;
-  pa = (s16)((struct OamData*)mem_oam)[4 * obj.matrixNum + 0].affineParam;
-  pb = (s16)((struct OamData*)mem_oam)[4 * obj.matrixNum + 1].affineParam;
-  pc = (s16)((struct OamData*)mem_oam)[4 * obj.matrixNum + 2].affineParam;
-  pd = (s16)((struct OamData*)mem_oam)[4 * obj.matrixNum + 3].affineParam;
+  pa = (s16)((const struct OamData*)mem.oam)[4 * obj.matrixNum + 0].affineParam;
+  pb = (s16)((const struct OamData*)mem.oam)[4 * obj.matrixNum + 1].affineParam;
+  pc = (s16)((const struct OamData*)mem.oam)[4 * obj.matrixNum + 2].affineParam;
+  pd = (s16)((const struct OamData*)mem.oam)[4 * obj.matrixNum + 3].affineParam;
 
   u32 px0 = size.width >> 1;
   u32 py0 = size.height >> 1;
@@ -304,7 +255,7 @@ static inline void RenderAffineObject(const struct OamData& obj, u32 scanline, P
   const int ix_min = std::max(-start_x, 0);
   const int ix_max = std::min<int>(start_x + fictional_width, frontend::GbaWidth) - start_x;
   for (int ix = ix_min; ix < ix_max; ix++) {
-    if (dest[start_x + ix].IsFilled()) continue;
+    if (dest.IsDone(start_x + ix)) continue;
 
     // todo: check window
     // transform
@@ -315,172 +266,207 @@ static inline void RenderAffineObject(const struct OamData& obj, u32 scanline, P
     if (px >= size.width || py >= size.height) continue;
 
     // todo: object window
-    SetAffineObjPixel(obj, &dest[start_x + ix], size, px, py, obj_1d_mapping);
+    SetAffineObjPixel(mem, obj, dest, start_x + ix, size, px, py, obj_1d_mapping);
   }
 }
 
-static inline std::vector<struct OamData> GetObjects(u32 scanline) {
-  const u16 dispcnt = REG_DISPCNT;
-  if (!(dispcnt & DISPCNT_OBJ_ON)) {
-    return {};
-  }
-  std::vector<std::pair<u32, struct OamData>> oam{};
-
-  for (u16 i = 0; i < 0x80; i++) {
-    struct OamData obj = ((struct OamData*)mem_oam)[i];
-
-    if (obj.affineMode == 0b10) continue;  // sprite hidden
-    if (obj.objMode    == 0b10) continue;  // object window
-
-    s16 obj_y = obj.y;
-    if (obj_y > frontend::GbaHeight) obj_y -= 0x100;
-    const ObjSize size = ObjSizeTable[obj.shape][obj.size];
-    switch (obj.affineMode) {
-      case 0b00:
-      case 0b01:
-        if (std::clamp<s16>(obj_y, scanline - size.height + 1, scanline) == obj_y)
-          oam.emplace_back(i, obj);
-        break;
-      case 0b11:
-        // affine double
-        if (std::clamp<s16>(obj_y, scanline - 2 * size.height + 1, scanline) == obj_y)
-          oam.emplace_back(i, obj);
-        break;
-      default:
-        log_fatal("Invalid object mode: %x", obj.objMode);
-    }
+static ObjectBins Bins = {};
+static u8 BinnedOam[sizeof(mem_oam)] = {};
+static bool BinnedObjEnable = false;
+static bool BinsValid = false;
+
+static void BinObjects() {
+  std::memset(Bins.count, 0, sizeof(Bins.count));
+  if (!BinnedObjEnable) {
+    return;
   }
 
-  // sort based on priority, then index
-  std::sort(oam.begin(), oam.end(), [](auto& obj_a, auto& obj_b) {
-    if (obj_a.second.priority == obj_b.second.priority) {
-      return obj_a.first < obj_b.first;
+  for (u32 priority = 0; priority < 4; priority++) {
+    for (u8 i = 0; i < 0x80; i++) {
+      const struct OamData& obj = ((struct OamData*)BinnedOam)[i];
+
+      if (obj.priority != priority) continue;
+      if (obj.affineMode == 0b10) continue;  // sprite hidden
+      if (obj.objMode    == 0b10) continue;  // object window
+
+      s16 obj_y = obj.y;
+      if (obj_y > frontend::GbaHeight) obj_y -= 0x100;
+      const ObjSize size = ObjSizeTable[obj.shape][obj.size];
+      const s32 height   = obj.affineMode == 0b11 ? 2 * size.height : size.height;  // affine double
+
+      const s32 first = std::max<s32>(obj_y, 0);
+      const s32 last  = std::min<s32>(obj_y + height, frontend::GbaHeight);
+      for (s32 scanline = first; scanline < last; scanline++) {
+        Bins.index[scanline][Bins.count[scanline]++] = i;
+      }
     }
-    return obj_a.second.priority < obj_b.second.priority;
-  });
+  }
+}
 
-  std::vector<struct OamData> result{};
-  result.reserve(oam.size());
-  std::transform(oam.begin(), oam.end(), std::back_inserter(result), [](const auto& p) { return p.second; });
-  return result;
+const ObjectBins& GetObjectBins(const PPUState& state) {
+  // objects only have to be rebinned if OAM or the OBJ enable bit changed
+  const bool obj_enable = (state.dispcnt & DISPCNT_OBJ_ON) != 0;
+  if (!BinsValid || obj_enable != BinnedObjEnable || std::memcmp(BinnedOam, state.mem.oam, sizeof(BinnedOam)) != 0) {
+    std::memcpy(BinnedOam, state.mem.oam, sizeof(BinnedOam));
+    BinnedObjEnable = obj_enable;
+    BinsValid = true;
+    BinObjects();
+  }
+  return Bins;
 }
 
-static inline void RenderObject(const struct OamData& obj, u32 scanline, Pixel* dest, bool obj_1d_mapping) {
+static inline void RenderObject(const VideoMemory& mem, const struct OamData& obj, u32 scanline, Scanline& dest, bool obj_1d_mapping) {
   switch (obj.affineMode) {
     case 0b00:
-      RenderRegularObject(obj, scanline, dest, obj_1d_mapping);
+      RenderRegularObject(mem, obj, scanline, dest, obj_1d_mapping);
       break;
     case 0b01:
       // affine
     case 0b11:
       // affine double
-      RenderAffineObject(obj, scanline, dest, obj_1d_mapping);
+      RenderAffineObject(mem, obj, scanline, dest, obj_1d_mapping);
+      break;
+  }
+}
+
+static inline void ComposeScanline(const PPUState& state, color_t* dest, const Scanline& scanline) {
+  static constexpr auto White = []{
+    std::array<u16, frontend::GbaWidth> line{};
+    line.fill(0x7fff);
+    return line;
+  }();
+  static constexpr std::array<u16, frontend::GbaWidth> Black = {};
+
+  switch (state.blend_mode) {
+    case BlendMode::Off:
+      std::memcpy(dest, scanline.top, sizeof(scanline.top));
+      break;
+    case BlendMode::Normal:
+      BlendLine(dest, scanline.top, scanline.bottom, scanline.flags, Scanline::TopBlend | Scanline::BottomBlend, state.eva, state.evb);
+      break;
+    case BlendMode::White:
+      BlendLine(dest, scanline.top, White.data(), scanline.flags, Scanline::Fade, 0x10 - state.evy, state.evy);
+      break;
+    case BlendMode::Black:
+      BlendLine(dest, scanline.top, Black.data(), scanline.flags, Scanline::Fade, 0x10 - state.evy, state.evy);
       break;
   }
 }
 
-static inline void ComposeScanline(color_t* dest, Pixel* scanline) {
-  const u16 bldcnt = REG_BLDCNT;
-  auto blend_mode = static_cast<BlendMode>((bldcnt >> 6) & 3);
-  bool backdrop_top   = (bldcnt >> 5) & 1;
-  bool backdrop_bottom = (bldcnt >> 13) & 1;
+StateChanges StateChangesFrom(u32 offset) {
+  static constexpr auto Table = []{
+    std::array<StateChanges, StateRegistersSize / sizeof(u16)> table{};
+    auto set = [&](u32 offset, StateChanges changes) { table[offset / sizeof(u16)] = changes; };
 
-  const u16 bldalpha = REG_BLDALPHA;
-  u16 eva = std::clamp<u16>(bldalpha & 0x1f, 0, 16);
-  u16 evb = std::clamp<u16>((bldalpha >> 8) & 0x1f, 0, 16);
-  u16 evy = std::clamp<u16>(REG_BLDY & 0x1f, 0, 16);
+    set(REG_OFFSET_DISPCNT, DisplayControlChange | LayerChange);
+    for (u32 bg = 0; bg < 4; bg++) {
+      set(REG_OFFSET_BG0CNT + 2 * bg, BGChange(bg) | LayerChange);
+      set(REG_OFFSET_BG0HOFS + 4 * bg, BGChange(bg));
+      set(REG_OFFSET_BG0VOFS + 4 * bg, BGChange(bg));
+    }
+    for (u32 offset = REG_OFFSET_BG2PA; offset < REG_OFFSET_BG3PA; offset += 2) set(offset, BGChange(2));
+    for (u32 offset = REG_OFFSET_BG3PA; offset < REG_OFFSET_WIN0H; offset += 2) set(offset, BGChange(3));
+    // GetBGData takes the reference point of BG3 from BG2X/Y as well
+    for (u32 offset = REG_OFFSET_BG2X; offset < REG_OFFSET_BG3PA; offset += 2) set(offset, BGChange(2) | BGChange(3));
+    // the blend targets are part of the BGData
+    set(REG_OFFSET_BLDCNT, BlendChange | AllBGsChange);
+    set(REG_OFFSET_BLDALPHA, BlendChange);
+    set(REG_OFFSET_BLDY, BlendChange);
+    return table;
+  }();
+
+  return Table[offset / sizeof(u16)];
+}
 
-  u16 backdrop = *(vu16*)mem_pltt;
-  for (int i = 0; i < frontend::GbaWidth; i++) {
-    dest[i] = scanline[i].GetColor(blend_mode, backdrop, backdrop_top, backdrop_bottom, eva, evb, evy);
+void UpdatePPUState(PPUState& state, StateChanges changes) {
+  if (changes & DisplayControlChange) {
+    state.dispcnt        = REG_DISPCNT;
+    state.mode           = state.dispcnt & 0x3;
+    state.obj_1d_mapping = (state.dispcnt & DISPCNT_OBJ_1D_MAP) != 0;
+  }
+
+  for (u32 bg = 0; bg < 4; bg++) {
+    if (changes & BGChange(bg)) state.bg[bg] = GetBGData(bg);
   }
-}
 
-void RenderScanline(u32 scanline, color_t* dest) {
-  Pixel pixels[frontend::GbaWidth] = {};
-
-  const u16 dispcnt = REG_DISPCNT;
-  u16 mode = dispcnt & 0x3;
-
-  auto objects = GetObjects(scanline);
-  auto curr_obj = objects.begin();
-  bool obj_1d_mapping = (dispcnt & DISPCNT_OBJ_1D_MAP) != 0;
-
-  // only modes 0 and 1 are used in pokeruby
-  // just look for DISPCNT_MODE_x macros, and you will not find any
-  // other than 0 and 1
-  switch (mode) {
-    case 0: {
-      // order layers by priority
-      std::array<u32, 4>       layers = { 0, 1, 2, 3 };
-      const std::array<u32, 4> priorities  = {
-          REG_BG0CNT & 3u,
-          REG_BG1CNT & 3u,
-          REG_BG2CNT & 3u,
-          REG_BG3CNT & 3u,
-      };
-
-      std::sort(layers.begin(), layers.end(), [&](auto l, auto r) {
-        if (priorities[l] == priorities[r]) {
-          return l < r;
-        }
-        return priorities[l] < priorities[r];
-      });
-
-      for (const auto& layer : layers) {
-        for (; curr_obj != objects.end() && curr_obj->priority <= priorities[layer]; curr_obj++)
-          RenderObject(*curr_obj, scanline, pixels, obj_1d_mapping);
-        RenderRegularScanline(layer, scanline, pixels);
+  if (changes & LayerChange) {
+    // only modes 0 and 1 are used in pokeruby
+    // just look for DISPCNT_MODE_x macros, and you will not find any
+    // other than 0 and 1
+    u32 first_bg, last_bg;
+    switch (state.mode) {
+      case 0: first_bg = 0; last_bg = 3; break;
+      case 1: first_bg = 0; last_bg = 2; break;
+      case 2: first_bg = 2; last_bg = 3; break;
+      default: {
+        log_fatal("Unimplemented rendering mode: %d", state.mode);
       }
-      break;
     }
-    case 1: {
-      // order layers by priority
-      std::array<u32, 3>       layers = { 0, 1, 2 };
-      const std::array<u32, 4> priorities  = {
-          REG_BG0CNT & 3u,
-          REG_BG1CNT & 3u,
-          REG_BG2CNT & 3u,
-      };
-
-      std::sort(layers.begin(), layers.end(), [&](auto l, auto r) {
-        if (priorities[l] == priorities[r]) {
-          return l < r;
-        }
-        return priorities[l] < priorities[r];
-      });
-
-      for (const auto& layer: layers) {
-        for (; curr_obj != objects.end() && curr_obj->priority <= priorities[layer]; curr_obj++)
-          RenderObject(*curr_obj, scanline, pixels, obj_1d_mapping);
-        if (layer == 2) {
-          // affine layer
-          RenderAffineScanline(2, scanline, pixels);
-        }
-        else {
-          RenderRegularScanline(layer, scanline, pixels);
-        }
-      }
-      break;
+
+    state.layer_count = 0;
+    for (u32 bg = 0; bg < 4; bg++) {
+      state.affine[bg] = (state.mode == 1 && bg == 2) || (state.mode == 2);
+
+      if (bg < first_bg || bg > last_bg) continue;
+      if (!(state.dispcnt & (0x0100 << bg))) continue;  // disabled in dispcnt
+      state.layers[state.layer_count++] = bg;
     }
-    case 2: {
-      if ((REG_BG3CNT & 3) < (REG_BG2CNT & 3)) {
-        // 3 is only rendered first if its priority is strictly lower
-        RenderAffineScanline(3, scanline, pixels);
-        RenderAffineScanline(2, scanline, pixels);
-      }
-      else {
-        RenderAffineScanline(2, scanline, pixels);
-        RenderAffineScanline(3, scanline, pixels);
-      }
-      break;
+
+    // order layers by priority, lower index goes first on equal priority
+    std::stable_sort(state.layers, state.layers + state.layer_count, [&](auto l, auto r) {
+      return state.bg[l].priority < state.bg[r].priority;
+    });
+  }
+
+  if (changes & BlendChange) {
+    const u16 bldcnt = REG_BLDCNT;
+    state.blend_mode      = static_cast<BlendMode>((bldcnt >> 6) & 3);
+    state.backdrop_top    = (bldcnt >> 5) & 1;
+    state.backdrop_bottom = (bldcnt >> 13) & 1;
+
+    const u16 bldalpha = REG_BLDALPHA;
+    state.eva = std::clamp<u16>(bldalpha & 0x1f, 0, 16);
+    state.evb = std::clamp<u16>((bldalpha >> 8) & 0x1f, 0, 16);
+    state.evy = std::clamp<u16>(REG_BLDY & 0x1f, 0, 16);
+  }
+}
+
+PPUState GetPPUState() {
+  PPUState state;
+  state.mem = {mem_vram, mem_pltt, mem_oam};
+  UpdatePPUState(state, AllChanges);
+  return state;
+}
+
+void RenderScanline(const PPUState& state, const ObjectBins& objects, u32 scanline, color_t* dest) {
+  Scanline pixels;
+  pixels.Clear(*(const u16*)state.mem.pltt, state.backdrop_top, state.backdrop_bottom);
+
+  const u8* obj_index = objects.index[scanline];
+  const u8* obj_end   = obj_index + objects.count[scanline];
+  auto render_objects = [&](u32 max_priority) {
+    for (; obj_index != obj_end; obj_index++) {
+      const struct OamData& obj = ((const struct OamData*)state.mem.oam)[*obj_index];
+      if (obj.priority > max_priority) break;
+      RenderObject(state.mem, obj, scanline, pixels, state.obj_1d_mapping);
     }
-    default: {
-      log_fatal("Unimplemented rendering mode: %d", mode);
+  };
+
+  for (u32 i = 0; i < state.layer_count; i++) {
+    const u32 layer = state.layers[i];
+    render_objects(state.bg[layer].priority);
+    if (state.affine[layer]) {
+      RenderAffineScanline(state.mem, state.bg[layer], scanline, pixels);
+    }
+    else {
+      RenderRegularScanline(state.mem, state.bg[layer], scanline, pixels);
     }
   }
 
-  ComposeScanline(dest, pixels);
+  // objects behind all backgrounds
+  render_objects(3);
+
+  ComposeScanline(state, dest, pixels);
 }
 
 }
\ No newline at end of file
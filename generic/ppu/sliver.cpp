@@ -0,0 +1,103 @@
+#include "sliver.h"
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SLIVER_X86
+#include <immintrin.h>
+#endif
+
+
+namespace ppu {
+
+static inline u64 FlipIndices(u64 indices) {
+  // indices are stored one per byte, so reversing the bytes flips the sliver
+  return __builtin_bswap64(indices);
+}
+
+static void DecodeSliverScalar(Sliver& sliver, const u8* tile_line, const u16* palette, bool hflip) {
+  u64 indices;
+  std::memcpy(&indices, tile_line, sizeof(indices));
+  if (hflip) indices = FlipIndices(indices);
+  std::memcpy(sliver.index, &indices, sizeof(indices));
+
+  sliver.opaque = 0;
+  for (int i = 0; i < 8; i++) {
+    sliver.opaque |= (sliver.index[i] != 0) << i;
+    sliver.color[i] = palette[sliver.index[i]];
+  }
+}
+
+#ifdef SLIVER_X86
+
+__attribute__((target("sse2")))
+static inline __m128i FlipIndicesSSE2(__m128i indices) {
+  // reverse the 4 words, then the bytes within each word
+  indices = _mm_shufflelo_epi16(indices, _MM_SHUFFLE(0, 1, 2, 3));
+  return _mm_or_si128(_mm_slli_epi16(indices, 8), _mm_srli_epi16(indices, 8));
+}
+
+__attribute__((target("sse2")))
+static inline void StoreIndicesSSE2(Sliver& sliver, __m128i indices) {
+  _mm_storel_epi64((__m128i*)sliver.index, indices);
+  const int transparent = _mm_movemask_epi8(_mm_cmpeq_epi8(indices, _mm_setzero_si128()));
+  sliver.opaque = ~transparent & 0xff;
+}
+
+__attribute__((target("sse2")))
+static void DecodeSliverSSE2(Sliver& sliver, const u8* tile_line, const u16* palette, bool hflip) {
+  __m128i indices = _mm_loadl_epi64((const __m128i*)tile_line);
+  if (hflip) indices = FlipIndicesSSE2(indices);
+  StoreIndicesSSE2(sliver, indices);
+  for (int i = 0; i < 8; i++) {
+    sliver.color[i] = palette[sliver.index[i]];
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void LookupColorsAVX2(Sliver& sliver, __m128i indices, const u16* palette) {
+  const __m256i index32 = _mm256_cvtepu8_epi32(indices);
+  const __m256i opaque  = _mm256_cmpgt_epi32(index32, _mm256_setzero_si256());
+
+  // gather 32 bits ending at the palette entry, so that we never read past the end of palette RAM
+  // transparent pixels (index 0) are masked out, so we never read before the start either
+  const __m256i gathered = _mm256_mask_i32gather_epi32(
+      _mm256_setzero_si256(),
+      (const int*)((const u8*)palette - sizeof(u16)),
+      index32,
+      opaque,
+      sizeof(u16)
+  );
+  const __m256i colors = _mm256_srli_epi32(gathered, 16);
+  _mm_storeu_si128(
+      (__m128i*)sliver.color,
+      _mm_packus_epi32(_mm256_castsi256_si128(colors), _mm256_extracti128_si256(colors, 1))
+  );
+}
+
+__attribute__((target("avx2")))
+static void DecodeSliverAVX2(Sliver& sliver, const u8* tile_line, const u16* palette, bool hflip) {
+  __m128i indices = _mm_loadl_epi64((const __m128i*)tile_line);
+  if (hflip) indices = _mm_shuffle_epi8(indices, _mm_set_epi8(15, 14, 13, 12, 11, 10, 9, 8, 0, 1, 2, 3, 4, 5, 6, 7));
+  StoreIndicesSSE2(sliver, indices);
+  LookupColorsAVX2(sliver, indices, palette);
+}
+
+#endif
+
+static DecodeSliverFn SelectDecoder() {
+#ifdef SLIVER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return DecodeSliverAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return DecodeSliverSSE2;
+  }
+#endif
+  return DecodeSliverScalar;
+}
+
+const DecodeSliverFn DecodeSliver = SelectDecoder();
+
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "helpers.h"
+
+namespace ppu {
+
+// one row of 8 pixels of a tile, in screen order (after flipping)
+struct Sliver {
+  u8 index[8];
+  u16 color[8];
+  u8 opaque;  // bit i is set if pixel i is not transparent
+};
+
+// tile_line holds one palette index per byte (8bpp tiles, or 4bpp tiles from ExpandedVram)
+using DecodeSliverFn = void (*)(Sliver& sliver, const u8* tile_line, const u16* palette, bool hflip);
+
+// with AVX2 the 8 colors are gathered at once, with SSE2 only the indices and the flip are vectorized,
+// and the colors are looked up one by one
+extern const DecodeSliverFn DecodeSliver;
+
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "ppu.h"
+#include "internal.h"
+#include "writewatch.h"
+
+#include <cstring>
+#include <algorithm>
+
+#undef max
+#undef min
+
+
+namespace ppu {
+
+static constexpr u32 TileSize  = 0x20;  // 4bpp tile
+static constexpr u32 TileCount = sizeof(mem_vram) / TileSize;
+
+alignas(64) u8 ExpandedVram[2 * sizeof(mem_vram)] = {};
+
+// VRAM as it was when the tiles were expanded
+static u8 CachedVram[sizeof(mem_vram)] = {};
+static DirtyTiles MarkedTiles = {};
+
+void MarkVramDirty(const void* dest, u32 size) {
+  const uintptr_t start      = (uintptr_t)dest;
+  const uintptr_t end        = start + size;
+  const uintptr_t vram_start = (uintptr_t)mem_vram;
+  const uintptr_t vram_end   = vram_start + sizeof(mem_vram);
+  if (!size || end <= vram_start || start >= vram_end) return;
+
+  const u32 first = (std::max(start, vram_start) - vram_start) / TileSize;
+  const u32 last  = (std::min(end, vram_end) - 1 - vram_start) / TileSize;
+  for (u32 tile = first; tile <= last; tile++) {
+    MarkedTiles.set(tile);
+  }
+}
+
+DirtyTiles TakeDirtyTiles() {
+  const DirtyTiles dirty = MarkedTiles;
+  MarkedTiles.reset();
+  writewatch::RearmVram();
+  return dirty;
+}
+
+static void ExpandTile(const u8* vram, u32 tile) {
+  const u8* packed = &vram[tile * TileSize];
+  u8* expanded     = &ExpandedVram[2 * tile * TileSize];
+
+  // low nibble is the left pixel
+  for (u32 i = 0; i < TileSize; i++) {
+    expanded[2 * i]     = packed[i] & 0xf;
+    expanded[2 * i + 1] = packed[i] >> 4;
+  }
+  std::memcpy(&CachedVram[tile * TileSize], packed, TileSize);
+}
+
+// tiles are compared in groups first, most of VRAM does not change between frames
+static constexpr u32 GroupTiles = 32;
+
+void RefreshTileCache(const u8* vram, const DirtyTiles& dirty) {
+  static_assert(TileCount == DirtyTiles().size());
+  static_assert(TileCount % GroupTiles == 0);
+
+  // the write watch marks the plain pointer writes as well
+  if (writewatch::TracksVram()) {
+    RefreshMarkedTiles(vram, dirty);
+    return;
+  }
+
+  // the game also writes to VRAM through plain pointers (text rendering for example),
+  // which never goes through MarkVramDirty, so without the write watch this is still a compare of all of VRAM,
+  // only the expanding is per tile
+  for (u32 group = 0; group < TileCount; group += GroupTiles) {
+    const u32 offset = group * TileSize;
+    bool marked = false;
+    for (u32 tile = group; tile < group + GroupTiles; tile++) marked |= dirty[tile];
+    if (!marked && std::memcmp(&CachedVram[offset], &vram[offset], GroupTiles * TileSize) == 0) continue;
+
+    for (u32 tile = group; tile < group + GroupTiles; tile++) {
+      if (dirty[tile] || std::memcmp(&CachedVram[tile * TileSize], &vram[tile * TileSize], TileSize) != 0) {
+        ExpandTile(vram, tile);
+      }
+    }
+  }
+}
+
+void RefreshMarkedTiles(const u8* vram, const DirtyTiles& dirty) {
+  if (dirty.none()) return;
+  for (u32 tile = 0; tile < TileCount; tile++) {
+    if (dirty[tile]) ExpandTile(vram, tile);
+  }
+}
+
+}
\ No newline at end of file
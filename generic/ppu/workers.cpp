@@ -0,0 +1,92 @@
+#include "workers.h"
+
+#include <algorithm>
+
+#undef max
+#undef min
+
+
+namespace ppu {
+
+BandRenderer::BandRenderer() {
+  band_count = std::clamp<u32>(std::thread::hardware_concurrency(), 1, MaxBands);
+  log_info("Rendering frames in %d bands", band_count);
+
+  for (u32 band = 1; band < band_count; band++) {
+    workers.emplace_back(&BandRenderer::Work, this, band);
+  }
+}
+
+BandRenderer::~BandRenderer() {
+  {
+    std::lock_guard lock(mutex);
+    quit = true;
+  }
+  start.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+BandRenderer& GetBandRenderer() {
+  static BandRenderer band_renderer{};
+  return band_renderer;
+}
+
+void BandRenderer::RenderBand(u32 band) {
+  const u32 first = band * frontend::GbaHeight / band_count;
+  const u32 last  = (band + 1) * frontend::GbaHeight / band_count;
+  for (u32 i = first; i < last; i++) {
+    RenderScanline(current_states[i * current_stride], *current_objects, i, current_screen + i * frontend::GbaWidth);
+  }
+}
+
+void BandRenderer::Work(u32 band) {
+  u64 last_frame = 0;
+  while (true) {
+    {
+      std::unique_lock lock(mutex);
+      start.wait(lock, [&]{ return quit || frame != last_frame; });
+      if (quit) return;
+      last_frame = frame;
+    }
+
+    RenderBand(band);
+
+    bool last;
+    {
+      std::lock_guard lock(mutex);
+      last = --pending == 0;
+    }
+    if (last) done.notify_one();
+  }
+}
+
+void BandRenderer::Render(const PPUState& state, const ObjectBins& objects, color_t* screen) {
+  Render(&state, 0, objects, screen);
+}
+
+void BandRenderer::Render(const PPUState* line_states, const ObjectBins& objects, color_t* screen) {
+  Render(line_states, 1, objects, screen);
+}
+
+void BandRenderer::Render(const PPUState* states, u32 state_stride, const ObjectBins& objects, color_t* screen) {
+  {
+    std::lock_guard lock(mutex);
+    current_states  = states;
+    current_stride  = state_stride;
+    current_objects = &objects;
+    current_screen  = screen;
+    pending = band_count - 1;
+    frame++;
+  }
+  start.notify_all();
+
+  RenderBand(0);
+
+  // states, objects and screen have to stay valid until all workers are done
+  std::unique_lock lock(mutex);
+  done.wait(lock, [&]{ return pending == 0; });
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ppu.h"
+#include "internal.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace ppu {
+
+// renders a frame split into horizontal bands, one per thread
+// the calling thread renders the first band itself, the others are rendered
+// by persistent worker threads, so no threads are created per frame
+struct BandRenderer {
+  static constexpr u32 MaxBands = 4;
+
+  BandRenderer();
+  ~BandRenderer();
+
+  // all scanlines are rendered from the same state, so this is only valid for frames without raster effects
+  void Render(const PPUState& state, const ObjectBins& objects, color_t* screen);
+  // every scanline is rendered from its own state
+  void Render(const PPUState* line_states, const ObjectBins& objects, color_t* screen);
+
+private:
+  void Render(const PPUState* states, u32 state_stride, const ObjectBins& objects, color_t* screen);
+  void RenderBand(u32 band);
+  void Work(u32 band);
+
+  u32 band_count;
+  std::vector<std::thread> workers{};
+
+  std::mutex mutex{};
+  std::condition_variable start{};
+  std::condition_variable done{};
+  u64 frame   = 0;
+  u32 pending = 0;
+  bool quit   = false;
+
+  // only valid during Render
+  const PPUState* current_states    = nullptr;
+  u32 current_stride                = 0;  // 0 if all scanlines share a state
+  const ObjectBins* current_objects = nullptr;
+  color_t* current_screen           = nullptr;
+};
+
+// created on first use, and shared by everything that renders full frames
+BandRenderer& GetBandRenderer();
+
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 #define asm(...)
 
 #include "gba/defines.h"
+#include "game_sections.h"
 
 // replace naked macro because this will mess up
 #define NAKED
@@ -0,0 +1,224 @@
+#include "rewind.h"
+#include "savestate.h"
+#include "log.h"
+
+#include <deque>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#undef max
+#undef min
+
+namespace rewinding {
+
+// frames are save states, stored as the XOR with the last keyframe, run length encoded:
+//
+//   repeated: varint number of unchanged bytes, varint length, length XOR'ed bytes
+//
+// keyframes are encoded the same way, against all zeros, most of memory is zeros anyway
+// all frames live in one ring buffer, the oldest frames are dropped to make room for new ones
+struct Entry {
+  size_t offset;  // in Ring
+  size_t size;
+  size_t state_size;
+  bool keyframe;
+};
+
+static std::vector<u8> Ring{};
+static size_t RingHead = 0;  // where the next frame goes
+static size_t RingUsed = 0;
+static std::deque<Entry> Entries{};  // oldest first
+
+static u32 KeyframeInterval = 60;
+static u32 SinceKeyframe = 0;
+
+static std::vector<u8> State{};     // scratch for save states
+static std::vector<u8> Keyframe{};  // state of the newest keyframe
+static std::vector<u8> Zeros{};     // what keyframes are encoded against
+static std::vector<u8> Encoded{};   // scratch for encoded frames
+
+void SetBudget(size_t bytes) {
+  Ring.assign(bytes, 0);
+  Ring.shrink_to_fit();
+  RingHead = 0;
+  RingUsed = 0;
+  Entries.clear();
+  SinceKeyframe = 0;
+}
+
+void SetKeyframeInterval(u32 frames) {
+  KeyframeInterval = std::max<u32>(frames, 1);
+  SinceKeyframe = 0;
+}
+
+static bool Equal8(const u8* a, const u8* b) {
+  u64 x, y;
+  std::memcpy(&x, a, sizeof(x));
+  std::memcpy(&y, b, sizeof(y));
+  return x == y;
+}
+
+static void PutVarint(std::vector<u8>& out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back((u8)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((u8)value);
+}
+
+static size_t GetVarint(const u8*& in) {
+  size_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    const u8 byte = *in++;
+    value |= (size_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return value;
+  }
+}
+
+static void Encode(const u8* state, const u8* base, size_t size, std::vector<u8>& out) {
+  out.clear();
+  size_t i = 0;
+  while (i < size) {
+    // unchanged bytes, 8 at a time for as long as we can
+    const size_t skip_start = i;
+    while (i + 8 <= size && Equal8(state + i, base + i)) i += 8;
+    while (i < size && state[i] == base[i]) i++;
+    if (i == size) break;  // unchanged bytes at the end are implied
+
+    // changed bytes, until there are enough unchanged ones for a skip to pay off
+    const size_t literal_start = i;
+    while (i < size && !(i + 8 <= size && Equal8(state + i, base + i))) i++;
+
+    PutVarint(out, literal_start - skip_start);
+    PutVarint(out, i - literal_start);
+    for (size_t j = literal_start; j < i; j++) {
+      out.push_back(state[j] ^ base[j]);
+    }
+  }
+}
+
+// XOR an encoded frame into state, which holds what it was encoded against
+static void Decode(const std::vector<u8>& encoded, std::vector<u8>& state) {
+  const u8* in = encoded.data();
+  const u8* const end = encoded.data() + encoded.size();
+  u8* out = state.data();
+  while (in < end) {
+    out += GetVarint(in);
+    const size_t length = GetVarint(in);
+    for (size_t i = 0; i < length; i++) {
+      out[i] ^= in[i];
+    }
+    in  += length;
+    out += length;
+  }
+}
+
+static void ReadEntry(const Entry& entry, std::vector<u8>& out) {
+  out.resize(entry.size);
+  const size_t first = std::min(entry.size, Ring.size() - entry.offset);
+  std::memcpy(out.data(), &Ring[entry.offset], first);
+  std::memcpy(out.data() + first, Ring.data(), entry.size - first);
+}
+
+static void DropOldest() {
+  RingUsed -= Entries.front().size;
+  Entries.pop_front();
+}
+
+// make room for size bytes, frames without their keyframe are dropped as well
+static void MakeRoom(size_t size) {
+  if (Ring.size() - RingUsed >= size) return;
+
+  while (!Entries.empty() && Ring.size() - RingUsed < size) {
+    DropOldest();
+  }
+  while (!Entries.empty() && !Entries.front().keyframe) {
+    DropOldest();
+  }
+}
+
+static void Store(const std::vector<u8>& encoded, size_t state_size, bool keyframe) {
+  const size_t first = std::min(encoded.size(), Ring.size() - RingHead);
+  std::memcpy(&Ring[RingHead], encoded.data(), first);
+  std::memcpy(Ring.data(), encoded.data() + first, encoded.size() - first);
+
+  Entries.push_back({RingHead, encoded.size(), state_size, keyframe});
+  RingHead = (RingHead + encoded.size()) % Ring.size();
+  RingUsed += encoded.size();
+}
+
+void Capture() {
+  if (Ring.empty()) return;
+
+  // flash is left out, it only changes when the game saves,
+  // and rewinding should not take back saves, or restore flash many times per second
+  savestate::Save(State, false);
+  if (Zeros.size() != State.size()) {
+    Zeros.assign(State.size(), 0);
+  }
+
+  // states change size when the game sets up sound, deltas need the same size
+  bool keyframe = SinceKeyframe == 0 || Entries.empty() || Keyframe.size() != State.size();
+  Encode(State.data(), keyframe ? Zeros.data() : Keyframe.data(), State.size(), Encoded);
+
+  MakeRoom(Encoded.size());
+  if (!keyframe && Entries.empty()) {
+    // we just dropped our own keyframe
+    keyframe = true;
+    Encode(State.data(), Zeros.data(), State.size(), Encoded);
+    MakeRoom(Encoded.size());
+  }
+  if (Encoded.size() > Ring.size() - RingUsed) {
+    static bool warned = false;
+    if (!warned) {
+      log_warn("Rewind buffer is too small to hold a single frame");
+      warned = true;
+    }
+    return;
+  }
+
+  Store(Encoded, State.size(), keyframe);
+  if (keyframe) {
+    std::swap(Keyframe, State);
+  }
+  SinceKeyframe = (SinceKeyframe + 1) % KeyframeInterval;
+}
+
+bool StepBack() {
+  if (Entries.empty()) return false;
+
+  const Entry entry = Entries.back();
+  Entries.pop_back();
+  RingHead  = entry.offset;
+  RingUsed -= entry.size;
+  ReadEntry(entry, Encoded);
+
+  if (entry.keyframe) {
+    State.assign(entry.state_size, 0);
+  }
+  else {
+    State = Keyframe;
+  }
+  Decode(Encoded, State);
+  savestate::Load(State);
+
+  // find the keyframe new frames will be stored against
+  size_t keyframe_index = Entries.size();
+  while (keyframe_index > 0 && !Entries[keyframe_index - 1].keyframe) keyframe_index--;
+  if (keyframe_index == 0) {
+    SinceKeyframe = 0;
+    return true;
+  }
+  keyframe_index--;
+
+  if (entry.keyframe) {
+    ReadEntry(Entries[keyframe_index], Encoded);
+    Keyframe.assign(Entries[keyframe_index].state_size, 0);
+    Decode(Encoded, Keyframe);
+  }
+  SinceKeyframe = (u32)((Entries.size() - keyframe_index) % KeyframeInterval);
+  return true;
+}
+
+}
\ No newline at end of file
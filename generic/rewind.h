@@ -0,0 +1,21 @@
+#pragma once
+
+#include "helpers.h"
+
+// (not "rewind", that one is taken by stdio)
+namespace rewinding {
+
+// memory for the history, 0 disables rewinding
+void SetBudget(size_t bytes);
+
+// every this many frames, a full snapshot is stored, the others only store what changed since then
+void SetKeyframeInterval(u32 frames);
+
+// store the current state, called once per frame between frames
+void Capture();
+
+// go back to the last captured frame and drop it from the history
+// returns false if there is nothing left to rewind to
+bool StepBack();
+
+}
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "savestate.h"
+#include "agb_flash_port.h"
+#include "ppu/ppu.h"
+#include "log.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+extern "C" {
+extern u32 intr_check;
+extern u32 intr_vector;
+
+extern u8 mem_ewram[0x40000];
+extern u8 mem_iwram[0x8000];
+
+// defined in m4a_internal.c, where the struct is known
+extern const size_t SoundInfoSize;
+
+void SoundResetHostState();
+}
+
+namespace savestate {
+
+// a save state is a header, followed by chunks of raw memory:
+//
+//   header: u32 magic, u16 version, u16 chunk count, u64 layout
+//   chunk:  u32 id, u32 size, size bytes of data
+//
+// everything is little endian, the layout is a hash of where things are in memory,
+// states with a different layout hold pointers that are no good to us
+struct Header {
+  static constexpr u32 ExpectedMagic  = 0x54535250;  // "PRST"
+  static constexpr u16 CurrentVersion = 1;
+
+  u32 magic;
+  u16 version;
+  u16 chunk_count;
+  u64 layout;
+};
+static_assert(sizeof(Header) == 16);
+
+struct ChunkHeader {
+  u32 id;
+  u32 size;
+};
+static_assert(sizeof(ChunkHeader) == 8);
+
+static constexpr u32 ChunkId(const char (&name)[5]) {
+  return (u32)name[0] | ((u32)name[1] << 8) | ((u32)name[2] << 16) | ((u32)name[3] << 24);
+}
+
+static constexpr u32 FlashChunk     = ChunkId("FLSH");
+static constexpr u32 SoundInfoChunk = ChunkId("SNDI");
+
+struct Span {
+  u8* data;
+  size_t size;
+};
+
+// the game's globals are put in their own sections by game_sections.h
+#if defined(__clang__) && defined(_WIN32)
+// the linker sorts grouped sections by the part after the $,
+// so these end up right before and after the game's globals
+extern "C" {
+__attribute__((section("gdata$a"), used)) u8 GameDataStart = 1;
+__attribute__((section("gdata$z"), used)) u8 GameDataEnd   = 1;
+__attribute__((section("gbss$a"), used)) u8 GameBssStart;
+__attribute__((section("gbss$z"), used)) u8 GameBssEnd;
+}
+
+static Span GameData() {
+  return {&GameDataStart, (size_t)((uintptr_t)&GameDataEnd - (uintptr_t)&GameDataStart)};
+}
+
+static Span GameBss() {
+  return {&GameBssStart, (size_t)((uintptr_t)&GameBssEnd - (uintptr_t)&GameBssStart)};
+}
+#elif defined(__ELF__)
+// the linker defines these for sections named like identifiers
+// weak, so that we still link if there are none
+extern "C" {
+extern u8 __start_game_data[] __attribute__((weak));
+extern u8 __stop_game_data[] __attribute__((weak));
+extern u8 __start_game_bss[] __attribute__((weak));
+extern u8 __stop_game_bss[] __attribute__((weak));
+}
+
+static Span GameData() {
+  return {__start_game_data, (size_t)((uintptr_t)__stop_game_data - (uintptr_t)__start_game_data)};
+}
+
+static Span GameBss() {
+  return {__start_game_bss, (size_t)((uintptr_t)__stop_game_bss - (uintptr_t)__start_game_bss)};
+}
+#else
+// todo: other platforms
+static Span GameData() { return {nullptr, 0}; }
+static Span GameBss() { return {nullptr, 0}; }
+#endif
+
+struct Region {
+  u32 id;
+  Span span;
+};
+
+static std::array<Region, 13> GetRegions() {
+  return {{
+      {ChunkId("INTR"), {reinterpret_cast<u8*>(&intr_check), sizeof(intr_check)}},
+      {ChunkId("IVEC"), {reinterpret_cast<u8*>(&intr_vector), sizeof(intr_vector)}},
+      {ChunkId("IORG"), {IORegisters, sizeof(IORegisters)}},
+      {ChunkId("TRAP"), {TrappedIORegisters, sizeof(TrappedIORegisters)}},
+      {ChunkId("DMA "), {reinterpret_cast<u8*>(DmaRegisters), DmaRegistersSize}},
+      {ChunkId("PLTT"), {mem_pltt, sizeof(mem_pltt)}},
+      {ChunkId("VRAM"), {mem_vram, sizeof(mem_vram)}},
+      {ChunkId("OAM "), {mem_oam, sizeof(mem_oam)}},
+      {ChunkId("EWRM"), {mem_ewram, sizeof(mem_ewram)}},
+      {ChunkId("IWRM"), {mem_iwram, sizeof(mem_iwram)}},
+      {ChunkId("GDAT"), GameData()},
+      {ChunkId("GBSS"), GameBss()},
+      {ChunkId("SPTR"), {reinterpret_cast<u8*>(&sound_info), sizeof(sound_info)}},
+  }};
+}
+
+static u64 Layout() {
+  // anything that moves when the build or its load address changes
+  const uintptr_t addresses[] = {
+      (uintptr_t)mem_ewram,
+      (uintptr_t)DmaRegisters,
+      (uintptr_t)GameData().data,
+      GameData().size,
+      (uintptr_t)GameBss().data,
+      GameBss().size,
+      SoundInfoSize,
+  };
+
+  u64 hash = 0xcbf29ce484222325ull;
+  for (uintptr_t address : addresses) {
+    for (size_t i = 0; i < sizeof(address); i++) {
+      hash = (hash ^ ((address >> (8 * i)) & 0xff)) * 0x100000001b3ull;
+    }
+  }
+  return hash;
+}
+
+static std::array<std::vector<u8>, NumSlots> Slots{};
+
+void Save(std::vector<u8>& buffer, bool with_flash) {
+  const auto regions = GetRegions();
+  if (!GameData().size && !GameBss().size) {
+    static bool warned = false;
+    if (!warned) {
+      log_warn("The game's globals can't be found in this build, save states will be incomplete");
+      warned = true;
+    }
+  }
+
+  // the SoundInfo is only there once the game has set up sound
+  const bool has_sound_info = sound_info != nullptr;
+
+  size_t size = sizeof(Header);
+  for (const auto& region : regions) {
+    size += sizeof(ChunkHeader) + region.span.size;
+  }
+  if (with_flash) size += sizeof(ChunkHeader) + flash::FlashSize;
+  if (has_sound_info) size += sizeof(ChunkHeader) + SoundInfoSize;
+
+  buffer.resize(size);
+  u8* out = buffer.data();
+
+  auto write_chunk = [&](u32 id, size_t chunk_size) {
+    const ChunkHeader chunk = {id, (u32)chunk_size};
+    std::memcpy(out, &chunk, sizeof(chunk));
+    out += sizeof(chunk);
+    u8* data = out;
+    out += chunk_size;
+    return data;
+  };
+
+  const Header header = {
+      Header::ExpectedMagic,
+      Header::CurrentVersion,
+      (u16)(regions.size() + with_flash + has_sound_info),
+      Layout()
+  };
+  std::memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+
+  for (const auto& region : regions) {
+    std::memcpy(write_chunk(region.id, region.span.size), region.span.data, region.span.size);
+  }
+  if (with_flash) {
+    flash::CopyFlashMemory(write_chunk(FlashChunk, flash::FlashSize));
+  }
+  if (has_sound_info) {
+    std::memcpy(write_chunk(SoundInfoChunk, SoundInfoSize), sound_info, SoundInfoSize);
+  }
+}
+
+bool Load(const std::vector<u8>& buffer) {
+  const u8* in = buffer.data();
+  const u8* const end = buffer.data() + buffer.size();
+
+  Header header;
+  if (buffer.size() < sizeof(header)) {
+    log_warn("Save state is too small");
+    return false;
+  }
+  std::memcpy(&header, in, sizeof(header));
+  in += sizeof(header);
+
+  if (header.magic != Header::ExpectedMagic) {
+    log_warn("Not a save state");
+    return false;
+  }
+  if (header.version != Header::CurrentVersion) {
+    log_warn("Unsupported save state version %d", header.version);
+    return false;
+  }
+  if (header.layout != Layout()) {
+#if defined(__PIE__) || defined(__pie__)
+    // printed in release builds too, nothing will ever load in such a build
+    std::fprintf(stderr, "Save state does not match this build, which is position independent and moves every run, "
+                         "save states only work in builds linked with -no-pie, see CMakeLists.txt\n");
+#else
+    log_warn("Save state was made by a different build");
+#endif
+    return false;
+  }
+
+  // check everything before touching any state
+  const auto regions = GetRegions();
+  std::array<const u8*, std::tuple_size_v<decltype(regions)>> region_data{};
+  const u8* flash_data = nullptr;
+  const u8* sound_info_data = nullptr;
+
+  for (u32 i = 0; i < header.chunk_count; i++) {
+    ChunkHeader chunk;
+    if ((size_t)(end - in) < sizeof(chunk)) {
+      log_warn("Save state is truncated");
+      return false;
+    }
+    std::memcpy(&chunk, in, sizeof(chunk));
+    in += sizeof(chunk);
+    if ((size_t)(end - in) < chunk.size) {
+      log_warn("Save state is truncated");
+      return false;
+    }
+
+    size_t expected_size;
+    if (chunk.id == FlashChunk) {
+      expected_size = flash::FlashSize;
+      flash_data = in;
+    }
+    else if (chunk.id == SoundInfoChunk) {
+      expected_size = SoundInfoSize;
+      sound_info_data = in;
+    }
+    else {
+      size_t index = 0;
+      while (index < regions.size() && regions[index].id != chunk.id) index++;
+      if (index == regions.size()) {
+        log_warn("Unknown save state chunk %08x", chunk.id);
+        return false;
+      }
+      expected_size = regions[index].span.size;
+      region_data[index] = in;
+    }
+
+    if (chunk.size != expected_size) {
+      log_warn("Save state chunk %08x has size %d, expected %d", chunk.id, chunk.size, (u32)expected_size);
+      return false;
+    }
+    in += chunk.size;
+  }
+
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (!region_data[i]) {
+      log_warn("Save state is missing chunks");
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < regions.size(); i++) {
+    std::memcpy(regions[i].span.data, region_data[i], regions[i].span.size);
+  }
+  if (flash_data) {
+    flash::RestoreFlashMemory(flash_data);
+  }
+  // sound_info itself has been restored with the regions
+  if (sound_info && sound_info_data) {
+    std::memcpy(sound_info, sound_info_data, SoundInfoSize);
+  }
+  // neither do the PSG channels and the mixer history, which are not saved
+  SoundResetHostState();
+
+  // the tile cache does not know VRAM changed underneath it
+  ppu::MarkVramDirty(mem_vram, sizeof(mem_vram));
+  return true;
+}
+
+void SaveSlot(int slot) {
+  if (slot < 0 || slot >= NumSlots) {
+    log_warn("Invalid save state slot %d", slot);
+    return;
+  }
+  Save(Slots[slot]);
+  log_info("Saved state to slot %d", slot);
+}
+
+bool LoadSlot(int slot) {
+  if (slot < 0 || slot >= NumSlots) {
+    log_warn("Invalid save state slot %d", slot);
+    return false;
+  }
+  if (Slots[slot].empty()) {
+    log_warn("Save state slot %d is empty", slot);
+    return false;
+  }
+  if (!Load(Slots[slot])) return false;
+  log_info("Loaded state from slot %d", slot);
+  return true;
+}
+
+bool SaveFile(const std::string& path) {
+  std::vector<u8> buffer{};
+  Save(buffer);
+
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  if (!file.is_open()) {
+    log_warn("Failed to open %s for writing", path.c_str());
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  log_info("Saved state to %s", path.c_str());
+  return true;
+}
+
+bool LoadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    log_warn("Failed to open save state %s", path.c_str());
+    return false;
+  }
+
+  std::vector<u8> buffer((size_t)file.tellg());
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+  if (!Load(buffer)) return false;
+  log_info("Loaded state from %s", path.c_str());
+  return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "helpers.h"
+
+#include <string>
+#include <vector>
+
+namespace savestate {
+
+// one per key, F1-F9
+static constexpr int NumSlots = 9;
+
+// save states have to be made and loaded between frames, from the game thread
+// they hold pointers, so they only load into the same build, see CMakeLists.txt
+
+// serialize the whole state into buffer, reusing its storage
+// without flash, loading the state leaves flash as it is
+void Save(std::vector<u8>& buffer, bool with_flash = true);
+// returns false and leaves the state untouched if the buffer does not fit this build
+bool Load(const std::vector<u8>& buffer);
+
+// in-memory slots
+void SaveSlot(int slot);
+bool LoadSlot(int slot);
+
+bool SaveFile(const std::string& path);
+bool LoadFile(const std::string& path);
+
+}
\ No newline at end of file
@@ -0,0 +1,376 @@
+#include "writewatch.h"
+#include "ppu/ppu.h"
+#include "log.h"
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#endif
+
+namespace writewatch {
+
+static Mode CurrentMode = Mode::Off;
+// one line per frame, with what was written in it
+static FILE* FrameLog = nullptr;
+
+#ifdef __linux__
+
+// the regions are write protected, the SIGSEGV handler catches the write and lifts the protection
+// in Pages mode, the page stays writable until it is re-armed
+// in Writes mode, the writing instruction is single stepped with the trap flag,
+// and the SIGTRAP handler protects the page again right after it
+//
+// with --audio-thread, the sound engine writes the sound registers from the audio thread,
+// so everything the handlers update is atomic
+
+#if defined(__x86_64__)
+#define HAS_TRAP_FLAG
+static uintptr_t ProgramCounter(const ucontext_t* context) { return context->uc_mcontext.gregs[REG_RIP]; }
+#elif defined(__i386__)
+#define HAS_TRAP_FLAG
+static uintptr_t ProgramCounter(const ucontext_t* context) { return context->uc_mcontext.gregs[REG_EIP]; }
+#endif
+
+#ifdef HAS_TRAP_FLAG
+static constexpr greg_t TrapFlag = 0x100;
+
+static void SetTrapFlag(ucontext_t* context, bool set) {
+  greg_t& flags = context->uc_mcontext.gregs[REG_EFL];
+  flags = set ? (flags | TrapFlag) : (flags & ~TrapFlag);
+}
+#endif
+
+// widest store an instruction can do, for marking VRAM from the address of a single write
+static constexpr u32 MaxWriteSize = 64;
+
+struct Region {
+  const char* name;
+  u8* data;
+  size_t size;
+
+  // pages that are protected, these may hold other globals too
+  uintptr_t first_page;
+  uintptr_t end_page;
+
+  std::atomic<u64> written_pages;  // since the region was last armed, by index from first_page
+  std::atomic<u64> frame_pages;    // written this frame, by index from first_page
+  std::atomic<u64> writes;         // caught writes, first writes to a page in Pages mode
+};
+
+static size_t PageSize = 0x1000;
+static_assert(sizeof(mem_vram) / 0x1000 <= 64, "Written pages are kept in a u64");
+static std::array<Region, 4> Regions{};
+static u64 Frames = 0;
+
+// Writes mode only
+static constexpr u32 RegisterCount = sizeof(IORegisters) / sizeof(u16);
+static std::array<std::atomic<u64>, RegisterCount> RegisterWrites{};
+// written this frame, a bit per register
+static std::array<std::atomic<u64>, RegisterCount / 64> FrameRegisters{};
+
+// instructions that wrote to the regions, in an open addressing hash table,
+// we can't allocate in a signal handler
+struct Writer {
+  std::atomic<uintptr_t> pc;
+  std::atomic<u64> count;
+};
+static constexpr u32 MaxWriters = 0x1000;
+static std::array<Writer, MaxWriters> Writers{};
+static std::atomic<u64> UncountedWrites{0};
+
+// pages to protect again after the single step, an unaligned write may touch 2 of them
+static thread_local std::array<uintptr_t, 4> SteppedPages{};
+static thread_local u32 SteppedPageCount = 0;
+
+static struct sigaction PreviousSegvAction{};
+static struct sigaction PreviousTrapAction{};
+
+static void Protect(uintptr_t page, size_t size, bool writable) {
+  mprotect((void*)page, size, PROT_READ | (writable ? PROT_WRITE : 0));
+}
+
+static void InitRegion(Region& region, const char* name, u8* data, size_t size) {
+  region.name       = name;
+  region.data       = data;
+  region.size       = size;
+  region.first_page = (uintptr_t)data & ~(PageSize - 1);
+  region.end_page   = ((uintptr_t)data + size + PageSize - 1) & ~(PageSize - 1);
+  region.written_pages = 0;
+  region.frame_pages   = 0;
+  region.writes        = 0;
+}
+
+static Region* FindRegion(uintptr_t address) {
+  for (auto& region : Regions) {
+    if (address >= region.first_page && address < region.end_page) return &region;
+  }
+  return nullptr;
+}
+
+static void CountWriter(uintptr_t pc) {
+  u32 index = (u32)((pc >> 2) ^ (pc >> 14)) & (MaxWriters - 1);
+  for (u32 probe = 0; probe < MaxWriters; probe++, index = (index + 1) & (MaxWriters - 1)) {
+    Writer& writer = Writers[index];
+    uintptr_t expected = 0;
+    // claim an empty slot, or find the one another thread claimed for this pc
+    if (writer.pc.compare_exchange_strong(expected, pc, std::memory_order_relaxed) || expected == pc) {
+      writer.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  UncountedWrites.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void OnSegv(int, siginfo_t* info, void* context) {
+  const uintptr_t address = (uintptr_t)info->si_addr;
+  Region* region = FindRegion(address);
+  if (!region) {
+    // a real crash, the write is retried and ends up with whoever handled this before
+    sigaction(SIGSEGV, &PreviousSegvAction, nullptr);
+    return;
+  }
+
+  const uintptr_t page = address & ~(PageSize - 1);
+  const u64 page_bit   = 1ull << ((page - region->first_page) / PageSize);
+  // unprotected before it is marked, so that an Arm in between protects it again on the next one
+  Protect(page, PageSize, true);
+  region->writes.fetch_add(1, std::memory_order_relaxed);
+  region->frame_pages.fetch_or(page_bit, std::memory_order_relaxed);
+
+  if (CurrentMode == Mode::Pages) {
+    region->written_pages.fetch_or(page_bit, std::memory_order_seq_cst);
+    if (region->data == mem_vram) ppu::MarkVramDirty((const void*)page, (u32)PageSize);
+    return;
+  }
+
+#ifdef HAS_TRAP_FLAG
+  const bool in_region = address >= (uintptr_t)region->data && address < (uintptr_t)region->data + region->size;
+  if (in_region && region->data == IORegisters) {
+    const u32 index = (u32)((address - (uintptr_t)IORegisters) / sizeof(u16));
+    RegisterWrites[index].fetch_add(1, std::memory_order_relaxed);
+    FrameRegisters[index / 64].fetch_or(1ull << (index % 64), std::memory_order_relaxed);
+  }
+  if (in_region && region->data == mem_vram) {
+    ppu::MarkVramDirty((const void*)address, MaxWriteSize);
+  }
+
+  auto* ucontext = static_cast<ucontext_t*>(context);
+  CountWriter(ProgramCounter(ucontext));
+  if (SteppedPageCount < SteppedPages.size()) {
+    SteppedPages[SteppedPageCount++] = page;
+  }
+  SetTrapFlag(ucontext, true);
+#endif
+}
+
+static void OnTrap(int signal, siginfo_t* info, void* context) {
+  if (!SteppedPageCount) {
+    // not one of our single steps, a breakpoint for example, it goes to whoever handled this before
+    if (PreviousTrapAction.sa_flags & SA_SIGINFO) {
+      PreviousTrapAction.sa_sigaction(signal, info, context);
+    }
+    else if (PreviousTrapAction.sa_handler != SIG_IGN && PreviousTrapAction.sa_handler != SIG_DFL) {
+      PreviousTrapAction.sa_handler(signal);
+    }
+    else if (PreviousTrapAction.sa_handler == SIG_DFL) {
+      // the trapping instruction is not run again, so the default action has to be raised
+      sigaction(SIGTRAP, &PreviousTrapAction, nullptr);
+      raise(SIGTRAP);
+    }
+    return;
+  }
+
+#ifdef HAS_TRAP_FLAG
+  for (u32 i = 0; i < SteppedPageCount; i++) {
+    Protect(SteppedPages[i], PageSize, false);
+  }
+  SteppedPageCount = 0;
+  SetTrapFlag(static_cast<ucontext_t*>(context), false);
+#endif
+}
+
+static void Arm(Region& region) {
+  // pages written while we protect the others stay marked for the next time
+  const u64 written = region.written_pages.exchange(0, std::memory_order_seq_cst);
+  if (!written) return;
+
+  for (u32 i = 0; region.first_page + i * PageSize < region.end_page; i++) {
+    if (written & (1ull << i)) {
+      Protect(region.first_page + i * PageSize, PageSize, false);
+    }
+  }
+}
+
+bool Enable(Mode mode) {
+  Disable();
+  if (mode == Mode::Off) return true;
+
+#ifndef HAS_TRAP_FLAG
+  if (mode == Mode::Writes) {
+    std::fprintf(stderr, "Watching every write needs the x86 trap flag\n");
+    return false;
+  }
+#endif
+
+  PageSize = (size_t)sysconf(_SC_PAGESIZE);
+  // the regions are aligned to 4 KiB in helpers.data.cpp, larger pages would protect the globals around them
+  if (PageSize != 0x1000) {
+    std::fprintf(stderr, "Watching writes needs 4 KiB pages, this system uses %zu bytes\n", PageSize);
+    return false;
+  }
+  InitRegion(Regions[0], "I/O", IORegisters, sizeof(IORegisters));
+  InitRegion(Regions[1], "VRAM", mem_vram, sizeof(mem_vram));
+  InitRegion(Regions[2], "OAM", mem_oam, sizeof(mem_oam));
+  InitRegion(Regions[3], "palette", mem_pltt, sizeof(mem_pltt));
+  struct sigaction action{};
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_SIGINFO;
+  action.sa_sigaction = OnSegv;
+  sigaction(SIGSEGV, &action, &PreviousSegvAction);
+  action.sa_sigaction = OnTrap;
+  sigaction(SIGTRAP, &action, &PreviousTrapAction);
+
+  CurrentMode = mode;
+  for (const auto& region : Regions) {
+    Protect(region.first_page, region.end_page - region.first_page, false);
+  }
+
+  // anything written before now was never marked
+  ppu::MarkVramDirty(mem_vram, sizeof(mem_vram));
+  return true;
+}
+
+void Disable() {
+  if (CurrentMode == Mode::Off) return;
+
+  for (auto& region : Regions) {
+    Protect(region.first_page, region.end_page - region.first_page, true);
+    region.written_pages = 0;
+    region.frame_pages   = 0;
+  }
+  for (auto& registers : FrameRegisters) registers = 0;
+  if (FrameLog) std::fflush(FrameLog);
+  sigaction(SIGSEGV, &PreviousSegvAction, nullptr);
+  sigaction(SIGTRAP, &PreviousTrapAction, nullptr);
+  CurrentMode = Mode::Off;
+}
+
+void RearmVram() {
+  if (CurrentMode == Mode::Pages) Arm(Regions[1]);
+}
+
+static void LogFrame() {
+  std::fprintf(FrameLog, "%llu:", (unsigned long long)Frames);
+  for (auto& region : Regions) {
+    std::fprintf(FrameLog, " %s %llx", region.name, (unsigned long long)region.frame_pages.exchange(0, std::memory_order_relaxed));
+  }
+  if (CurrentMode == Mode::Writes) {
+    std::fprintf(FrameLog, " registers");
+    for (u32 word = 0; word < FrameRegisters.size(); word++) {
+      const u64 written = FrameRegisters[word].exchange(0, std::memory_order_relaxed);
+      for (u32 bit = 0; bit < 64; bit++) {
+        if (written & (1ull << bit)) std::fprintf(FrameLog, " %03x", 2 * (64 * word + bit));
+      }
+    }
+  }
+  std::fprintf(FrameLog, "\n");
+}
+
+void EndFrame() {
+  if (CurrentMode == Mode::Off) return;
+
+  if (FrameLog) LogFrame();
+  Frames++;
+  if (CurrentMode == Mode::Pages) {
+    // VRAM is re-armed along with the tile cache
+    for (auto& region : Regions) {
+      if (region.data != mem_vram) Arm(region);
+    }
+  }
+}
+
+void LogReport() {
+  if (CurrentMode == Mode::Off || !Frames) return;
+
+  const char* what = CurrentMode == Mode::Pages ? "first writes to a page" : "writes";
+  std::printf("Writes over %d frames:\n", (u32)Frames);
+  for (const auto& region : Regions) {
+    const u64 writes = region.writes.load(std::memory_order_relaxed);
+    std::printf("  %-8s %10llu %s, %.1f per frame\n", region.name, (unsigned long long)writes, what, (double)writes / Frames);
+  }
+  if (CurrentMode != Mode::Writes) return;
+
+  // counted (register or pc, writes)
+  using Count = std::pair<uintptr_t, u64>;
+  const auto most_first = [](const Count& l, const Count& r) { return l.second > r.second; };
+
+  std::vector<Count> registers{};
+  for (u32 i = 0; i < RegisterWrites.size(); i++) {
+    const u64 writes = RegisterWrites[i].load(std::memory_order_relaxed);
+    if (writes) registers.emplace_back(i, writes);
+  }
+  std::sort(registers.begin(), registers.end(), most_first);
+  std::printf("Most written registers:\n");
+  for (u32 i = 0; i < std::min<size_t>(registers.size(), 16); i++) {
+    std::printf("  %03x %10llu\n", (u32)(2 * registers[i].first), (unsigned long long)registers[i].second);
+  }
+
+  std::vector<Count> writers{};
+  for (const auto& writer : Writers) {
+    const uintptr_t pc = writer.pc.load(std::memory_order_relaxed);
+    if (pc) writers.emplace_back(pc, writer.count.load(std::memory_order_relaxed));
+  }
+  std::sort(writers.begin(), writers.end(), most_first);
+  // names only show up for exported symbols, link with -rdynamic to get the game's functions
+  std::printf("Code writing the most (%llu writes not counted):\n", (unsigned long long)UncountedWrites.load(std::memory_order_relaxed));
+  for (u32 i = 0; i < std::min<size_t>(writers.size(), 32); i++) {
+    const auto [pc, count] = writers[i];
+    Dl_info info{};
+    if (dladdr((void*)pc, &info) && info.dli_sname) {
+      std::printf("  %10llu %s+%#zx\n", (unsigned long long)count, info.dli_sname, (size_t)(pc - (uintptr_t)info.dli_saddr));
+    }
+    else {
+      std::printf("  %10llu %p\n", (unsigned long long)count, (void*)pc);
+    }
+  }
+}
+
+#else
+
+bool Enable(Mode mode) {
+  if (mode == Mode::Off) return true;
+  std::fprintf(stderr, "Watching writes is not supported on this platform\n");
+  return false;
+}
+
+void Disable() { }
+void RearmVram() { }
+void EndFrame() { }
+void LogReport() { }
+
+#endif
+
+bool SetFrameLog(const char* path) {
+  if (FrameLog) std::fclose(FrameLog);
+  FrameLog = path ? std::fopen(path, "w") : nullptr;
+  if (path && !FrameLog) {
+    std::fprintf(stderr, "Could not open %s for the write watch log\n", path);
+    return false;
+  }
+  return true;
+}
+
+bool TracksVram() {
+  return CurrentMode != Mode::Off;
+}
+
+}
\ No newline at end of file
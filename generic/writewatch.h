@@ -0,0 +1,39 @@
+#pragma once
+
+#include "helpers.h"
+
+// catch the game's writes to IORegisters, VRAM, OAM and palette RAM, by write protecting them
+// this is Linux only for now, see testing/trap_test.c for how it goes on Windows
+namespace writewatch {
+
+enum class Mode {
+  Off,
+  // the first write to every page in a frame is caught, cheap enough to leave on
+  // written VRAM pages are marked dirty for the tile cache
+  Pages,
+  // every write is caught, and counted by register and by the code that did it, for profiling
+  Writes,
+};
+
+// returns false if the mode is not supported here
+bool Enable(Mode mode);
+void Disable();
+
+// whether every write to VRAM ends up in ppu::MarkVramDirty
+bool TracksVram();
+
+// start catching writes to VRAM pages again, called whenever the VRAM dirty marks are taken
+void RearmVram();
+
+// start catching writes to the other regions again, and count the frame
+void EndFrame();
+
+// also write a line per frame to path, with the pages of every region written in it,
+// and the registers in Writes mode
+// VRAM pages in Pages mode are only caught again once the renderer has taken the dirty marks
+bool SetFrameLog(const char* path);
+
+// what was written, and by whom, printed in release builds too
+void LogReport();
+
+}
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include "game_sections.h"
 #include "gba/gba.h"
 
 #include "global.h"
@@ -0,0 +1,176 @@
+// checks the high quality mixer against a reference that convolves one output sample at a time,
+// measures how far the sinc kernel holds down the first image of a tone next to linear interpolation,
+// then times it
+
+#include "m4a_internal.c"
+#include "m4a_stubs.h"
+
+#define TRIALS 100000
+#define WAVE_SIZE 70000
+#define ROM_RATE 13379
+#define RATE 48000
+
+// the same kernel, with the taps fetched through WaveSample for every sample
+static void ReferenceMix(struct SoundInfo *mixer, struct SoundChannel *chan, struct WaveData *wav, float *bus, u32 samples, u32 rate) {
+  const s32 loopLen = (chan->statusFlags & SOUND_CHANNEL_SF_LOOP) ? wav->size - wav->loopStart : 0;
+  const u32 frequency = (chan->type & 8) ? mixer->pcmFreq : chan->frequency;
+  const u32 step = ((u64)frequency << 23) / rate;
+  s32 count = chan->count;
+  s8 *current = chan->currentPointer;
+  u32 fw = chan->fw;
+
+  SetChannelVolume(mixer, chan);
+  const float envR = chan->envelopeVolumeRight;
+  const float envL = chan->envelopeVolumeLeft;
+  for (u32 i = 0; ; i++) {
+    while (count <= 0) {
+      if (!loopLen) {
+        chan->statusFlags = 0;
+        return;
+      }
+      current -= loopLen;
+      count += loopLen;
+    }
+    if (i == samples) break;
+
+    s8 taps[SINC_TAPS];
+    for (int tap = 0; tap < SINC_TAPS; tap++) {
+      taps[tap] = WaveSample(wav, current - wav->data + tap - SINC_TAPS_BEFORE, loopLen);
+    }
+    const float sample = Convolve(taps, SincKernel[fw >> SINC_PHASE_SHIFT]);
+    bus[2 * i] += sample * envL;
+    bus[2 * i + 1] += sample * envR;
+
+    const u64 position = (u64)fw + step;
+    current += position >> 23;
+    count -= position >> 23;
+    fw = position & FW_MASK;
+  }
+  chan->fw = fw;
+  chan->count = count;
+  chan->currentPointer = current;
+}
+
+// power of x at a frequency, over the left channel
+static double Power(const float *x, int samples, double frequency) {
+  const double pi = 3.14159265358979323846;
+  double re = 0, im = 0;
+  for (int i = 0; i < samples; i++) {
+    re += x[2 * i] * cos(2 * pi * frequency * i / RATE);
+    im += x[2 * i] * sin(2 * pi * frequency * i / RATE);
+  }
+  return re * re + im * im;
+}
+
+int main(void) {
+  static u8 wave_memory[sizeof(struct WaveData) + WAVE_SIZE];
+  struct WaveData *wav = (struct WaveData *)wave_memory;
+  srand(1);
+  for (int i = 0; i < WAVE_SIZE; i++) wav->data[i] = rand();
+
+  InitSincKernel();
+  struct SoundInfo mixer = {0};
+  mixer.masterVolume = 15;
+  mixer.pcmFreq = ROM_RATE;
+
+  static float mixed[2 * HQ_MAX_SAMPLES], expected[2 * HQ_MAX_SAMPLES];
+  int failures = 0;
+  for (int trial = 0; trial < TRIALS; trial++) {
+    wav->size = 1 + rand() % (trial & 1 ? 50 : 60000);
+    wav->loopStart = rand() % wav->size;
+
+    struct SoundChannel chan = {0};
+    chan.statusFlags = (rand() & 1 ? SOUND_CHANNEL_SF_LOOP : 0) | 3;
+    chan.type = rand() % 4 == 0 ? 8 : 0;
+    chan.envelopeVolume = rand();
+    chan.rightVolume = rand();
+    chan.leftVolume = rand();
+    chan.count = 1 + rand() % wav->size;
+    chan.currentPointer = wav->data + wav->size - chan.count;
+    chan.fw = rand() & FW_MASK;
+    chan.frequency = rand() % (trial & 2 ? 200000 : 30000);
+
+    const u32 samples = 1 + rand() % HQ_MAX_SAMPLES;
+    const u32 rate = trial & 4 ? 48000 : 44100;
+    struct SoundChannel reference = chan;
+    memset(mixed, 0, sizeof(mixed));
+    memset(expected, 0, sizeof(expected));
+    GenerateAudioHighQuality(&mixer, &chan, wav, mixed, samples, rate);
+    ReferenceMix(&mixer, &reference, wav, expected, samples, rate);
+
+    bool32 same = !memcmp(mixed, expected, sizeof(mixed)) && chan.statusFlags == reference.statusFlags;
+    if (same && chan.statusFlags) {
+      same = chan.fw == reference.fw && chan.count == reference.count && chan.currentPointer == reference.currentPointer;
+    }
+    if (!same && failures++ < 5) {
+      printf("trial %d differs: size %u loop %u frequency %u samples %u rate %u type %d\n",
+             trial, wav->size, wav->loopStart, chan.frequency, samples, rate, chan.type);
+    }
+  }
+  printf("%d of %d trials differ from the reference\n", failures, TRIALS);
+
+  // every phase passes constant input through unchanged
+  double dc_error = 0;
+  for (int phase = 0; phase < SINC_PHASES; phase++) {
+    double sum = 0;
+    for (int tap = 0; tap < SINC_TAPS; tap++) sum += SincKernel[phase][tap];
+    dc_error = fmax(dc_error, fabs(sum - 1));
+  }
+  printf("largest gain error at DC: %g\n", dc_error);
+  CHECK(dc_error < 1e-6);
+
+  // a 3 kHz sine at the rom rate, its first image is at 13379 - 3000 Hz
+  const double pi = 3.14159265358979323846;
+  wav->size = 60000;
+  wav->loopStart = 0;
+  for (int i = 0; i < 60000; i++) wav->data[i] = (s8)lround(100 * sin(2 * pi * 3000 * i / ROM_RATE));
+
+  static float bus[2 * 4800];
+  memset(bus, 0, sizeof(bus));
+  struct SoundChannel chan = {0};
+  chan.statusFlags = SOUND_CHANNEL_SF_LOOP | 3;
+  chan.count = 60000 - SINC_TAPS;
+  chan.currentPointer = wav->data + SINC_TAPS;
+  chan.envelopeVolume = chan.rightVolume = chan.leftVolume = 255;
+  chan.frequency = ROM_RATE;
+  for (int i = 0; i < 4800; i += HQ_MAX_SAMPLES / 2) {
+    GenerateAudioHighQuality(&mixer, &chan, wav, bus + 2 * i, HQ_MAX_SAMPLES / 2 < 4800 - i ? HQ_MAX_SAMPLES / 2 : 4800 - i, RATE);
+  }
+  const double sinc_db = 10 * log10(Power(bus, 4800, 3000) / Power(bus, 4800, ROM_RATE - 3000));
+
+  // the same tone with linear interpolation between the rom samples
+  const u32 step = ((u64)ROM_RATE << 23) / RATE;
+  const s8 *start = wav->data + SINC_TAPS;
+  for (int i = 0; i < 4800; i++) {
+    const u64 position = (u64)i * step;
+    const s32 base = start[position >> 23];
+    bus[2 * i] = (base + (((start[(position >> 23) + 1] - base) * (s32)(position & FW_MASK)) >> 23)) * 255;
+  }
+  const double linear_db = 10 * log10(Power(bus, 4800, 3000) / Power(bus, 4800, ROM_RATE - 3000));
+  printf("first image of a 3 kHz tone: %.1f dB below it with the sinc kernel, %.1f dB with linear interpolation\n",
+         sinc_db, linear_db);
+  CHECK(sinc_db > 60);
+  CHECK(sinc_db > linear_db + 30);
+
+  // 12 channels of 20 s at 48 kHz
+  chan.statusFlags = 0;
+  u64 total = 0;
+  const clock_t start_time = clock();
+  for (int frame = 0; frame < 60 * 20; frame++) {
+    for (int i = 0; i < 12; i++) {
+      if (!chan.statusFlags) {
+        chan.statusFlags = SOUND_CHANNEL_SF_LOOP | 3;
+        chan.count = 60000 - SINC_TAPS;
+        chan.currentPointer = wav->data + SINC_TAPS;
+        chan.envelopeVolume = 200;
+        chan.rightVolume = chan.leftVolume = 128;
+        chan.frequency = 22050 + i * 1000;
+      }
+      GenerateAudioHighQuality(&mixer, &chan, wav, mixed, 804, RATE);
+      total += 804;
+    }
+  }
+  printf("%.2f ns per channel and output sample\n", (double)(clock() - start_time) / CLOCKS_PER_SEC * 1e9 / total);
+
+  return failures != 0;
+}
\ No newline at end of file
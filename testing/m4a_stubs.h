@@ -0,0 +1,39 @@
+#pragma once
+
+// what m4a_internal.c needs from the rest of the port and from the decomp,
+// so that a test can include it on its own and call its static functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHECK(cond) do {                                              \
+    if (!(cond)) {                                                    \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                        \
+    }                                                                 \
+} while (0)
+
+const u8 gClockTable[1];
+const u8 gScaleTable[180];
+const u32 gFreqTable[12];
+void* gMPlayJumpTableTemplate[JUMP_TABLE_SIZE];
+char SoundMainRAM_Buffer[0x800];
+struct SoundInfo* sound_info = NULL;
+
+u8 IORegisters[0x400];
+u8 TrappedIORegisters[0x400];
+vu8* RegisterAccessIntercept(u32 offset) { return TrappedIORegisters + offset; }
+
+u32 umul3232H32(u32 a, u32 b) { return ((u64)a * b) >> 32; }
+void ClearChain(void* x) {}
+void TrkVolPitSet(struct MusicPlayerInfo* mplayInfo, struct MusicPlayerTrack* track) {}
+void ClearModM(struct MusicPlayerTrack* track) {}
+void FadeOutBody(struct MusicPlayerInfo* mplayInfo) {}
+void CpuSet(const void* src, void* dest, u32 control) {}
+
+void HelperPushSound(const s16* buffer, u32 samples, u32 sample_rate) {}
+u32 HelperHighQualitySoundRate(void) { return 0; }
+bool32 HelperSoundThreaded(void) { return FALSE; }
+bool32 HelperHoldsSoundState(void) { return TRUE; }
\ No newline at end of file
@@ -0,0 +1,118 @@
+// checks the fixed point mixer against a reference that steps one output sample at a time,
+// over random waves, loops, frequencies and start positions, then times it
+
+#include "m4a_internal.c"
+#include "m4a_stubs.h"
+
+#define TRIALS 200000
+#define MAX_SAMPLES 1584
+#define WAVE_SIZE 70000
+
+// the same 9.23 fixed point math, with the loop and end of the wave checked before every sample
+static void ReferenceMix(struct SoundChannel *chan, struct WaveData *wav, s32 *mix, u32 samples, u32 divFreq, s32 envR, s32 envL) {
+  const s32 loopLen = (chan->statusFlags & SOUND_CHANNEL_SF_LOOP) ? wav->size - wav->loopStart : 0;
+  const bool32 fixed = chan->type & 8;
+  const u32 step = fixed ? 1u << 23 : chan->frequency * divFreq;
+  s32 count = chan->count;
+  s8 *current = chan->currentPointer;
+  u32 fw = fixed ? 0 : chan->fw;
+
+  for (u32 i = 0; ; i++) {
+    while (count <= 0) {
+      if (!loopLen) {
+        chan->statusFlags = 0;
+        return;
+      }
+      current -= loopLen;
+      count += loopLen;
+    }
+    if (i == samples) break;
+
+    const s32 base = current[0];
+    const s32 sample = fixed ? base : base + (((current[1] - base) * (s32)fw) >> 23);
+    mix[2 * i] += sample * envL;
+    mix[2 * i + 1] += sample * envR;
+
+    const u64 position = (u64)fw + step;
+    current += position >> 23;
+    count -= position >> 23;
+    fw = position & FW_MASK;
+  }
+  chan->fw = fw;
+  chan->count = count;
+  chan->currentPointer = current;
+}
+
+static u32 DivFreq(u32 rate) {
+  return (16777216 / rate + 1) >> 1;
+}
+
+int main(void) {
+  static u8 wave_memory[sizeof(struct WaveData) + WAVE_SIZE];
+  struct WaveData *wav = (struct WaveData *)wave_memory;
+  srand(1);
+  for (int i = 0; i < WAVE_SIZE; i++) wav->data[i] = rand();
+
+  struct SoundInfo mixer = {0};
+  mixer.masterVolume = 15;
+
+  static s32 mixed[2 * MAX_SAMPLES], expected[2 * MAX_SAMPLES];
+  int failures = 0;
+  for (int trial = 0; trial < TRIALS; trial++) {
+    // short waves wrap many times a frame, long ones hardly ever
+    wav->size = 1 + rand() % (trial & 1 ? 50 : 60000);
+    wav->loopStart = rand() % wav->size;
+
+    struct SoundChannel chan = {0};
+    chan.statusFlags = (rand() & 1 ? SOUND_CHANNEL_SF_LOOP : 0) | 3;
+    chan.type = rand() % 4 == 0 ? 8 : 0;
+    chan.envelopeVolume = rand();
+    chan.rightVolume = rand();
+    chan.leftVolume = rand();
+    chan.count = 1 + rand() % wav->size;
+    chan.currentPointer = wav->data + wav->size - chan.count;
+    chan.fw = rand() & FW_MASK;
+    chan.frequency = rand() % (trial & 2 ? 200000 : 30000);
+
+    const u32 samples = 1 + rand() % MAX_SAMPLES;
+    struct SoundChannel reference = chan;
+    memset(mixed, 0, sizeof(mixed));
+    memset(expected, 0, sizeof(expected));
+    GenerateAudio(&mixer, &chan, wav, mixed, samples, DivFreq(13379));
+    ReferenceMix(&reference, wav, expected, samples, DivFreq(13379), chan.envelopeVolumeRight, chan.envelopeVolumeLeft);
+
+    bool32 same = !memcmp(mixed, expected, sizeof(mixed)) && chan.statusFlags == reference.statusFlags;
+    if (same && chan.statusFlags) {
+      same = chan.fw == reference.fw && chan.count == reference.count && chan.currentPointer == reference.currentPointer;
+    }
+    if (!same && failures++ < 5) {
+      printf("trial %d differs: size %u loop %u frequency %u samples %u type %d\n",
+             trial, wav->size, wav->loopStart, chan.frequency, samples, chan.type);
+    }
+  }
+  printf("%d of %d trials differ from the reference\n", failures, TRIALS);
+
+  // 12 channels of 20 s at 48 kHz
+  struct SoundChannel chan = {0};
+  wav->size = 60000;
+  wav->loopStart = 0;
+  u64 total = 0;
+  const clock_t start = clock();
+  for (int frame = 0; frame < 60 * 20; frame++) {
+    for (int i = 0; i < 12; i++) {
+      if (!chan.statusFlags) {
+        chan.statusFlags = SOUND_CHANNEL_SF_LOOP | 3;
+        chan.count = wav->size;
+        chan.currentPointer = wav->data;
+        chan.envelopeVolume = 200;
+        chan.rightVolume = chan.leftVolume = 128;
+        chan.frequency = 22050 + i * 1000;
+      }
+      GenerateAudio(&mixer, &chan, wav, mixed, 800, DivFreq(48000));
+      total += 800;
+    }
+  }
+  printf("%.2f ns per channel and output sample\n", (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / total);
+
+  return failures != 0;
+}
\ No newline at end of file
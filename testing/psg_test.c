@@ -0,0 +1,235 @@
+// drives the PSG synthesis through the registers the way CgbSound does,
+// and checks levels, envelope, length and sweep timing, the queued register writes,
+// and how far down the aliases of a square wave are next to a naive per-sample square
+
+#include "m4a_internal.c"
+#include "m4a_stubs.h"
+
+#define RATE 48000
+// 1/60 s, the sequencer clocks 512 times a second, so a block of these lines up with it every 15 blocks
+#define BLOCK 800
+
+static s32 Output[2 * 2 * RATE];
+
+// samples of output into Output, with the game thread's write backs after every block
+static void Render(u32 samples) {
+  for (u32 done = 0; done < samples; done += BLOCK) {
+    GeneratePsg(BLOCK, RATE);
+    SoundApplyRegisterWrites();
+    memcpy(Output + 2 * done, PsgBuffer, 2 * BLOCK * sizeof(*PsgBuffer));
+  }
+}
+
+static u32 Status(void) {
+  return REG_SOUNDCNT_X & 0xf;
+}
+
+static s32 Peak(const s32 *x, int samples) {
+  s32 peak = 0;
+  for (int i = 0; i < samples; i++) {
+    if (abs(x[2 * i]) > peak) peak = abs(x[2 * i]);
+  }
+  return peak;
+}
+
+static double Power(const s32 *x, int samples, double frequency) {
+  const double pi = 3.14159265358979323846;
+  double re = 0, im = 0;
+  for (int i = 0; i < samples; i++) {
+    re += x[2 * i] * cos(2 * pi * frequency * i / RATE);
+    im += x[2 * i] * sin(2 * pi * frequency * i / RATE);
+  }
+  return (re * re + im * im) * 2 / samples;
+}
+
+// how far below the harmonics everything else is, in dB, over a second of the left channel
+static double HarmonicsToRest(const s32 *x, const double *harmonics, int count) {
+  double mean = 0, total = 0, wanted = 0;
+  for (int i = 0; i < RATE; i++) mean += x[2 * i];
+  mean /= RATE;
+  for (int i = 0; i < RATE; i++) total += (x[2 * i] - mean) * (x[2 * i] - mean);
+  for (int k = 0; k < count; k++) wanted += Power(x, RATE, harmonics[k]);
+  return 10 * log10(wanted / (total - wanted));
+}
+
+static void Reset(void) {
+  memset(IORegisters, 0, sizeof(IORegisters));
+  SoundResetHostState();
+  // PSG on, full volume on both sides, at 100% of the mix
+  REG_SOUNDCNT_X = 0x80;
+  REG_SOUNDCNT_L = 0xff77;
+  REG_SOUNDCNT_H = 2;
+}
+
+int main(void) {
+  // volume 15, at 100% with master volume 7, is 4 * 15 * 8 * 8 either side of 0
+  const s32 level = 3840;
+
+  // a 256 Hz square at 50%, away from its edges it sits at the full level
+  Reset();
+  REG_SOUND1CNT_L = 0x08;
+  REG_SOUND1CNT_H = 0xf080;
+  REG_SOUND1CNT_X = 0x8000 | (2048 - 512);
+  Render(RATE / 2);
+  s32 high = 0, low = 0;
+  for (int i = RATE / 4; i < RATE / 2; i++) {
+    if (Output[2 * i] == level) high++;
+    if (Output[2 * i] == -level) low++;
+  }
+  printf("256 Hz square: %d samples at %d, %d at %d, peak %d\n", high, level, low, -level, Peak(Output, RATE / 2));
+  CHECK(high > RATE / 12 && low > RATE / 12);
+  // the edges ring a little past it, a full swing is twice the level
+  CHECK(Peak(Output, RATE / 2) < level * 5 / 4);
+  CHECK((REG_SOUND1CNT_X & 0x8000) == 0);
+  CHECK(Status() == 1);
+
+  // a 4096 Hz square, against the same square sampled naively
+  const double harmonics[] = {4096, 3 * 4096, 5 * 4096};
+  REG_SOUND1CNT_X = 0x8000 | (2048 - 32);
+  Render(2 * RATE);
+  const double blep_db = HarmonicsToRest(Output + 2 * RATE, harmonics, 3);
+  static s32 naive[2 * RATE];
+  for (int i = 0; i < RATE; i++) {
+    const double phase = fmod(i * 4096.0 / RATE, 1.0);
+    naive[2 * i] = ((PsgDutyPatterns[2] >> (int)(phase * 8)) & 1) ? level : -level;
+  }
+  const double naive_db = HarmonicsToRest(naive, harmonics, 3);
+  printf("4096 Hz square: aliases %.1f dB below the harmonics, %.1f dB for a naive square\n", blep_db, naive_db);
+  CHECK(blep_db > 40);
+  CHECK(blep_db > naive_db + 25);
+
+  // the envelope steps down every 1/64 s, to 7 after 1/8 s, silent after 1/4 s
+  REG_SOUND1CNT_H = 0xf180;
+  REG_SOUND1CNT_X = 0x8000 | (2048 - 512);
+  Render(RATE / 4);
+  // the plateaus between 1/8 s and the next step
+  int plateau = 0;
+  for (int i = RATE / 8; i < RATE / 8 + RATE / 128; i++) {
+    if (abs(Output[2 * i]) == 4 * 7 * 64) plateau++;
+  }
+  const s32 end = Peak(Output + 2 * (RATE / 4 - RATE / 100), RATE / 100);
+  printf("envelope: %d samples at volume 7 after 1/8 s, peak %d after 1/4 s, status %x\n", plateau, end, Status());
+  CHECK(plateau > RATE / 128 / 2);
+  CHECK(end < 64);
+  CHECK(Status() == 1);
+
+  // length 64 of 64, 1/4 s
+  REG_SOUND1CNT_H = 0xf080;
+  REG_SOUND1CNT_X = 0xc000 | (2048 - 512);
+  Render(RATE / 5);
+  const u32 before = Status();
+  Render(RATE / 10);
+  printf("length: status %x after 0.2 s, %x after 0.3 s\n", before, Status());
+  CHECK(before == 1 && Status() == 0);
+
+  // the sweep, every 1/128 s up by 1/128, 32 times in 1/4 s
+  // the swept frequency is queued for the game thread, and only written back in SoundApplyRegisterWrites
+  Reset();
+  REG_SOUND1CNT_L = 0x17;
+  REG_SOUND1CNT_H = 0xf000;
+  REG_SOUND1CNT_X = 0x8000 | 0x400;
+  u32 expected = 0x400;
+  for (int i = 0; i < 32; i++) expected += expected >> 7;
+  for (int i = 0; i < RATE / 4; i += BLOCK) {
+    GeneratePsg(BLOCK, RATE);
+  }
+  printf("sweep: register %03x before the write back, swept %03x, expected %03x\n", REG_SOUND1CNT_X & 0x7ff, PsgSweptFrequency, expected);
+  CHECK((REG_SOUND1CNT_X & 0x7ff) == 0x400 && Status() == 0);
+  CHECK(PsgSweptFrequency == expected);
+  SoundApplyRegisterWrites();
+  printf("sweep: register %03x after, status %x\n", REG_SOUND1CNT_X & 0x7ff, Status());
+  CHECK((REG_SOUND1CNT_X & 0x7ff) == expected && Status() == 1);
+  // a new frequency from the game takes over from the swept one
+  REG_SOUND1CNT_L = 0x08;
+  REG_SOUND1CNT_X = 0x200;
+  GeneratePsg(BLOCK, RATE);
+  CHECK(PsgSweptFrequency == 0x200);
+  // and up until it overflows, which silences the channel
+  REG_SOUND1CNT_L = 0x17;
+  REG_SOUND1CNT_X = 0x8000 | 1800;
+  Render(RATE);
+  printf("sweep: status %x after overflowing\n", Status());
+  CHECK(Status() == 0);
+
+  // a loaded state starts out silent, with the status bits cleared
+  REG_SOUND1CNT_L = 0x08;
+  REG_SOUND1CNT_X = 0x8000 | 0x400;
+  Render(BLOCK);
+  CHECK(Status() == 1);
+  SoundResetHostState();
+  CHECK(Status() == 0 && !PsgChannels[PSG_SQUARE1].on);
+  Render(BLOCK);
+  CHECK(Status() == 0 && Peak(Output, BLOCK) == 0);
+
+  // a 1024 Hz sine in wave RAM
+  Reset();
+  const double pi = 3.14159265358979323846;
+  vu8 *wave_ram = (vu8 *)&REG_WAVE_RAM0;
+  for (int i = 0; i < 16; i++) {
+    const int a = (int)lround(7.5 + 7.5 * sin(2 * pi * (2 * i) / 32));
+    const int b = (int)lround(7.5 + 7.5 * sin(2 * pi * (2 * i + 1) / 32));
+    wave_ram[i] = a << 4 | b;
+  }
+  REG_SOUND3CNT_L = 0x80;
+  REG_SOUND3CNT_H = 0x2000;
+  REG_SOUND3CNT_X = 0x8000 | (2048 - 64);
+  Render(2 * RATE);
+  const double sine[] = {1024};
+  const double wave_db = HarmonicsToRest(Output + 2 * RATE, sine, 1);
+  printf("1024 Hz sine on the wave channel: rest %.1f dB below, peak %d\n", wave_db, Peak(Output + 2 * RATE, RATE));
+  CHECK(wave_db > 20);
+  CHECK(Status() == 4);
+
+  // noise, around 0
+  Reset();
+  REG_SOUND4CNT_L = 0xf000;
+  REG_SOUND4CNT_H = 0x8000;
+  Render(RATE);
+  double mean = 0, energy = 0;
+  for (int i = 0; i < RATE; i++) {
+    mean += Output[2 * i];
+    energy += (double)Output[2 * i] * Output[2 * i];
+  }
+  printf("noise: mean %.0f, rms %.0f\n", mean / RATE, sqrt(energy / RATE));
+  CHECK(fabs(mean / RATE) < level / 10 && sqrt(energy / RATE) > level / 2);
+  CHECK(Status() == 8);
+
+  // square 1 on the left only
+  Reset();
+  REG_SOUNDCNT_L = 0x1077;
+  REG_SOUND1CNT_H = 0xf080;
+  REG_SOUND1CNT_X = 0x8000 | 1536;
+  Render(RATE / 10);
+  s32 right = 0;
+  for (int i = 0; i < RATE / 10; i++) {
+    if (abs(Output[2 * i + 1]) > right) right = abs(Output[2 * i + 1]);
+  }
+  printf("panned left: left %d, right %d\n", Peak(Output, RATE / 10), right);
+  CHECK(Peak(Output, RATE / 10) >= level && right == 0);
+
+  // all four channels for 60 s, at the game's rate and at the device's
+  Reset();
+  REG_SOUND1CNT_H = 0xf080;
+  REG_SOUND1CNT_X = 0x8000 | 1900;
+  REG_SOUND2CNT_L = 0xf040;
+  REG_SOUND2CNT_H = 0x8000 | 1950;
+  REG_SOUND3CNT_L = 0x80;
+  REG_SOUND3CNT_H = 0x2000;
+  REG_SOUND3CNT_X = 0x8000 | 1700;
+  REG_SOUND4CNT_L = 0xf000;
+  REG_SOUND4CNT_H = 0x8000 | 0x21;
+  const u32 rates[] = {13379, RATE};
+  for (int r = 0; r < 2; r++) {
+    u64 total = 0;
+    HqCycles = 0;
+    const clock_t start = clock();
+    for (int frame = 0; frame < 60 * 60; frame++) {
+      const u32 samples = HighQualitySamples(rates[r]);
+      GeneratePsg(samples, rates[r]);
+      total += samples;
+    }
+    printf("%u Hz: %.1f ns per output sample\n", rates[r], (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / total);
+  }
+
+  return 0;
+}
\ No newline at end of file
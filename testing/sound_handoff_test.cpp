@@ -0,0 +1,108 @@
+// stresses the threaded sound mode's handshake with a fake sound engine, build it with -fsanitize=thread
+// the game thread and the engine on the audio thread both write the same plain, unsynchronized state,
+// any overlap shows up as a race, or as a torn update
+// partway through, the game thread stalls for 300 ms with the state released, which should play through
+
+#include "audio.cpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static constexpr u32 DeviceRate  = 48000;
+static constexpr u32 GameRate    = 13379;
+static constexpr u32 FrameFrames = 224;
+static constexpr int Seconds     = 3;
+
+// stands in for SoundInfo and the music players, the two halves are always written together
+struct FakeSoundState {
+  u64 first;
+  u64 second;
+  u64 engine_frames;
+};
+
+static FakeSoundState State{};
+static std::atomic<int> Failures{0};
+
+static void Fail(const char* what) {
+  if (Failures.fetch_add(1) < 5) std::printf("%s\n", what);
+}
+
+static void Touch(u64 value) {
+  if (State.first != State.second) Fail("torn sound state");
+  State.first = value;
+  // give the other side time to run into it
+  std::this_thread::yield();
+  State.second = value;
+}
+
+extern "C" {
+
+void SoundMainThreaded() {
+  if (!HelperHoldsSoundState()) Fail("engine ran without the sound state");
+  Touch(State.first + 1);
+  State.engine_frames++;
+
+  static s16 buffer[2 * FrameFrames];
+  for (u32 i = 0; i < 2 * FrameFrames; i++) buffer[i] = (s16)(State.engine_frames + i);
+  HelperPushSound(buffer, FrameFrames, GameRate);
+}
+
+void SoundApplyRegisterWrites() {
+  if (!HelperHoldsSoundState()) Fail("register writes made without the sound state");
+}
+
+}
+
+int main() {
+  using Clock = std::chrono::steady_clock;
+
+  audio::SetThreaded(true);
+  audio::Open(DeviceRate);
+
+  std::atomic<bool> done{false};
+  std::thread device([&] {
+    // a callback's worth of frames every callback period, like the host's audio thread
+    const u32 count = audio::DeviceBufferFrames(DeviceRate);
+    const auto period = std::chrono::microseconds((u64)count * 1000000 / DeviceRate);
+    std::vector<audio::Frame> out(count);
+    auto next = Clock::now();
+    while (!done.load()) {
+      audio::Drain(out.data(), count);
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+  });
+
+  // 60 frames a second: game code with the state held, then rendering and pacing with it released
+  const auto start = Clock::now();
+  auto next = start;
+  u64 frame = 0;
+  bool stalled = false;
+  while (Clock::now() - start < std::chrono::seconds(Seconds)) {
+    audio::AcquireSoundState();
+    if (!HelperHoldsSoundState()) Fail("game thread does not hold the sound state after taking it");
+    Touch(State.first + 1);
+    frame++;
+    audio::ReleaseSoundState();
+
+    if (!stalled && Clock::now() - start > std::chrono::seconds(1)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      stalled = true;
+      next = Clock::now();
+    }
+    next += std::chrono::microseconds(16743);
+    std::this_thread::sleep_until(next);
+  }
+  audio::AcquireSoundState();
+  done.store(true);
+  device.join();
+  audio::Close();
+
+  const u64 underruns = audio::Underruns.load();
+  std::printf("%llu game frames, %llu engine frames, %llu underruns, %d failures\n",
+              (unsigned long long)frame, (unsigned long long)State.engine_frames,
+              (unsigned long long)underruns, Failures.load());
+  audio::LogReport();
+  return Failures.load() != 0 || underruns != 0 || State.engine_frames == 0;
+}
\ No newline at end of file